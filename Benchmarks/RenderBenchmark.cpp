@@ -0,0 +1,323 @@
+// Runs JUCEboxAudioProcessor offline, with no editor and no audio device, on
+// scripted MIDI and reports what processBlock costs. Optionally writes each
+// render to a WAV file so it can be diffed against a golden render.
+//
+// Built by the CMake project in the repository root:
+//   JUCEboxRenderBenchmark [--seconds 20] [--rates 44100,48000] [--blocks 64,256,512]
+//                          [--scenario chords|dense-loop|idle] [--metronome]
+//                          [--engine bank|voices] [--polyphony 128] [--instances 1]
+//                          [--wav out.wav] [--stats]
+//
+// --instances runs that many processors side by side on the same input, as in a
+// session with many of them, and the times cover all of them. With
+// --scenario idle it shows what instances that aren't playing cost.
+//
+// --stats prints the processor's per-stage timings, which needs a build with
+// JUCEBOX_ENABLE_INSTRUMENTATION (the CMake option JUCEBOX_INSTRUMENTATION).
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+    enum class Scenario { chords, denseLoop, idle };
+
+    struct Options
+    {
+        double seconds = 20.0;
+        juce::Array<double> sampleRates { 48000.0 };
+        juce::Array<int> blockSizes { 64, 256, 512 };
+        Scenario scenario = Scenario::chords;
+        bool metronome = false;
+        bool stats = false;
+        JUCEboxAudioProcessor::SynthEngine engine = JUCEboxAudioProcessor::SynthEngine::voiceBank;
+        int polyphony = JUCEboxAudioProcessor::defaultPolyphony;
+        int instances = 1;
+        juce::File wavFile;
+    };
+
+    // The scripted part: a note-on/note-off grid evaluated analytically, so any
+    // block size sees exactly the same events at the same samples.
+    struct Script
+    {
+        int64_t stepSamples;
+        int64_t noteLengthSamples;
+        int notesPerStep;
+        int64_t stopAfterSamples;   // no new notes from here on
+
+        static Script forScenario (Scenario scenario, double sampleRate, int64_t loopLength)
+        {
+            const auto beat = (int64_t) (0.5 * sampleRate);   // the processor's default 120 BPM
+
+            switch (scenario)
+            {
+                case Scenario::chords:    return { beat, beat - beat / 8, 4, std::numeric_limits<int64_t>::max() };
+                case Scenario::denseLoop: return { beat / 4, 3 * beat / 4, 6, loopLength };
+                case Scenario::idle:      break;
+            }
+
+            return { beat, 0, 0, 0 };
+        }
+
+        static int noteFor (int64_t step, int voice)
+        {
+            static constexpr int chord[] = { 0, 4, 7, 11, 14, 17 };
+            static constexpr int roots[] = { 48, 53, 55, 45, 50, 43, 52, 57 };
+            return roots[step % 8] + chord[voice % 6] + 12 * (voice / 6);
+        }
+
+        void addEvents (juce::MidiBuffer& midi, int64_t blockStart, int numSamples) const
+        {
+            if (notesPerStep == 0)
+                return;
+
+            const auto blockEnd = blockStart + numSamples;
+
+            // Steps whose note-off or note-on falls in this block
+            auto firstStep = juce::jmax ((int64_t) 0, (blockStart - noteLengthSamples) / stepSamples);
+
+            for (auto step = firstStep; step * stepSamples < blockEnd; ++step)
+            {
+                const auto onTime = step * stepSamples;
+
+                if (onTime >= stopAfterSamples)
+                    break;
+
+                const auto offTime = onTime + noteLengthSamples;
+
+                for (int v = 0; v < notesPerStep; ++v)
+                {
+                    if (offTime >= blockStart && offTime < blockEnd)
+                        midi.addEvent (juce::MidiMessage::noteOff (1, noteFor (step, v)), (int) (offTime - blockStart));
+
+                    if (onTime >= blockStart)
+                        midi.addEvent (juce::MidiMessage::noteOn (1, noteFor (step, v), (juce::uint8) (70 + 8 * v)),
+                                       (int) (onTime - blockStart));
+                }
+            }
+        }
+    };
+
+    struct Result
+    {
+        double nsPerSample, realtimeFactor;
+        double p50Micros, p99Micros, maxMicros;
+    };
+
+    bool writeWav (const juce::File& file, const juce::AudioBuffer<float>& audio, double sampleRate)
+    {
+        file.deleteFile();
+        std::unique_ptr<juce::OutputStream> stream (file.createOutputStream());
+
+        if (stream == nullptr)
+            return false;
+
+        juce::WavAudioFormat wav;
+        auto writer = wav.createWriterFor (stream, juce::AudioFormatWriterOptions{}.withSampleRate (sampleRate)
+                                                                                   .withNumChannels (audio.getNumChannels())
+                                                                                   .withBitsPerSample (24));
+        return writer != nullptr && writer->writeFromAudioSampleBuffer (audio, 0, audio.getNumSamples());
+    }
+
+    Result run (const Options& options, double sampleRate, int blockSize, const juce::File& wavFile)
+    {
+        std::vector<std::unique_ptr<JUCEboxAudioProcessor>> processors;
+
+        for (int i = 0; i < options.instances; ++i)
+        {
+            auto p = std::make_unique<JUCEboxAudioProcessor>();
+            p->setSynthEngine (options.engine);
+            p->setPolyphony (options.polyphony, VoiceBank::StealPolicy::oldest);
+            p->setRateAndBufferSizeDetails (sampleRate, blockSize);
+            p->prepareToPlay (sampleRate, blockSize);
+            processors.push_back (std::move (p));
+        }
+
+        auto& processor = *processors.front();
+        const auto numChannels = processor.getTotalNumOutputChannels();
+        const auto totalSamples = (int64_t) (options.seconds * sampleRate);
+        const auto loopLength = (int64_t) (60.0 / processor.getTempo() * 16.0 * sampleRate);
+        const auto script = Script::forScenario (options.scenario, sampleRate, loopLength);
+
+        // The dense loop is recorded over the first cycle, then played back. The
+        // metronome only runs while the looper does, so otherwise start an empty loop.
+        auto recordingLoop = options.scenario == Scenario::denseLoop;
+
+        for (auto& p : processors)
+        {
+            if (options.metronome)
+                p->toggleMetronome();
+
+            if (recordingLoop)
+                p->toggleRecording();
+            else if (options.metronome)
+            {
+                p->toggleRecording();
+                p->toggleRecording();
+            }
+        }
+
+        juce::AudioBuffer<float> block (numChannels, blockSize);
+        juce::AudioBuffer<float> render (wavFile == juce::File() ? 0 : numChannels, wavFile == juce::File() ? 0 : (int) totalSamples);
+        juce::MidiBuffer midi;
+        midi.ensureSize (4096);
+
+        std::vector<double> blockNanos;
+        blockNanos.reserve ((size_t) (totalSamples / blockSize + 1));
+        double totalNanos = 0.0;
+
+        for (int64_t pos = 0; pos < totalSamples; pos += blockSize)
+        {
+            const auto n = (int) juce::jmin ((int64_t) blockSize, totalSamples - pos);
+
+            if (recordingLoop && pos >= loopLength)
+            {
+                for (auto& p : processors)
+                    p->toggleRecording();
+
+                recordingLoop = false;
+            }
+
+            double nanos = 0.0;
+
+            // The first instance goes last, so the block holds its output for the render
+            for (auto i = processors.size(); i-- > 0;)
+            {
+                midi.clear();
+                script.addEvents (midi, pos, n);
+                block.setSize (numChannels, n, false, false, true);
+
+                const auto start = std::chrono::steady_clock::now();
+                processors[i]->processBlock (block, midi);
+                nanos += std::chrono::duration<double, std::nano> (std::chrono::steady_clock::now() - start).count();
+            }
+
+            blockNanos.push_back (nanos);
+            totalNanos += nanos;
+
+            for (int ch = 0; ch < render.getNumChannels(); ++ch)
+                render.copyFrom (ch, (int) pos, block, ch, 0, n);
+
+            if (options.stats)
+                processor.getPerformanceMonitor().collect();
+        }
+
+        for (auto& p : processors)
+            p->releaseResources();
+
+        if (options.stats)
+            std::printf ("%s", processor.getPerformanceMonitor().getReport().toRawUTF8());
+
+        if (render.getNumChannels() > 0 && ! writeWav (wavFile, render, sampleRate))
+            std::fprintf (stderr, "could not write %s\n", wavFile.getFullPathName().toRawUTF8());
+
+        std::sort (blockNanos.begin(), blockNanos.end());
+        auto percentile = [&] (double p) { return blockNanos[(size_t) (p * (double) (blockNanos.size() - 1))] / 1000.0; };
+
+        return { totalNanos / (double) totalSamples,
+                 options.seconds * 1.0e9 / totalNanos,
+                 percentile (0.5), percentile (0.99), blockNanos.back() / 1000.0 };
+    }
+
+    template <typename T>
+    // Empty if any of the values isn't above zero, which the caller treats as a bad option
+    juce::Array<T> parseList (const juce::String& text)
+    {
+        juce::Array<T> values;
+
+        for (auto& item : juce::StringArray::fromTokens (text, ",", ""))
+        {
+            const auto value = (T) item.getDoubleValue();
+
+            if (value <= 0)
+                return {};
+
+            values.add (value);
+        }
+
+        return values;
+    }
+
+    bool parseOptions (int argc, char* argv[], Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const juce::String arg (argv[i]);
+            const juce::String value (i + 1 < argc ? argv[i + 1] : "");
+
+            if (arg == "--metronome")                  { options.metronome = true; continue; }
+            if (arg == "--stats")                      { options.stats = true; continue; }
+            if (value.isEmpty())                       return false;
+
+            ++i;
+
+            if (arg == "--seconds")                    options.seconds = juce::jmax (0.1, value.getDoubleValue());
+            else if (arg == "--rates")                 options.sampleRates = parseList<double> (value);
+            else if (arg == "--blocks")                options.blockSizes = parseList<int> (value);
+            else if (arg == "--polyphony")             options.polyphony = juce::jlimit (1, JUCEboxAudioProcessor::maxPolyphony, value.getIntValue());
+            else if (arg == "--instances")             options.instances = juce::jmax (1, value.getIntValue());
+            else if (arg == "--wav")                   options.wavFile = juce::File::getCurrentWorkingDirectory().getChildFile (value);
+            else if (arg == "--engine")
+            {
+                if (value == "bank")                   options.engine = JUCEboxAudioProcessor::SynthEngine::voiceBank;
+                else if (value == "voices")            options.engine = JUCEboxAudioProcessor::SynthEngine::synthesiserVoices;
+                else                                   return false;
+            }
+            else if (arg == "--scenario")
+            {
+                if (value == "chords")                 options.scenario = Scenario::chords;
+                else if (value == "dense-loop")        options.scenario = Scenario::denseLoop;
+                else if (value == "idle")              options.scenario = Scenario::idle;
+                else                                   return false;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return ! options.sampleRates.isEmpty() && ! options.blockSizes.isEmpty();
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    Options options;
+
+    if (! parseOptions (argc, argv, options))
+    {
+        std::fprintf (stderr, "usage: %s [--seconds s] [--rates r1,r2] [--blocks b1,b2] [--scenario chords|dense-loop|idle]\n"
+                              "          [--metronome] [--engine bank|voices] [--polyphony n] [--instances n] [--wav file] [--stats]\n", argv[0]);
+        return 1;
+    }
+
+    // Creating the processors starts their parameter timers, which need a message manager
+    juce::MessageManager::getInstance();
+
+    const auto oneConfig = options.sampleRates.size() == 1 && options.blockSizes.size() == 1;
+    std::printf ("%8s %6s %12s %10s %10s %10s %10s\n", "rate", "block", "ns/sample", "x realtime", "p50 us", "p99 us", "max us");
+
+    for (auto sampleRate : options.sampleRates)
+    {
+        for (auto blockSize : options.blockSizes)
+        {
+            auto wavFile = options.wavFile;
+
+            if (wavFile != juce::File() && ! oneConfig)
+                wavFile = wavFile.getSiblingFile (wavFile.getFileNameWithoutExtension()
+                                                  + "_" + juce::String ((int) sampleRate) + "_" + juce::String (blockSize) + ".wav");
+
+            const auto r = run (options, sampleRate, blockSize, wavFile);
+            std::printf ("%8.0f %6d %12.2f %10.1f %10.2f %10.2f %10.2f\n",
+                         sampleRate, blockSize, r.nsPerSample, r.realtimeFactor, r.p50Micros, r.p99Micros, r.maxMicros);
+        }
+    }
+
+    juce::DeletedAtShutdown::deleteAll();
+    juce::MessageManager::deleteInstance();
+    return 0;
+}
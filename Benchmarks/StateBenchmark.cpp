@@ -0,0 +1,174 @@
+// Measures how fast the plugin's session state is written and read back, for a
+// synthetic loop of the given size, and checks that the loop survives the trip.
+//
+// Built by the CMake project in the repository root:
+//   JUCEboxStateBenchmark [--notes 25000] [--iterations 200]
+//
+// The default is 25000 notes, which is 50000 loop events.
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+    struct Options
+    {
+        int notes = 25000;
+        int iterations = 200;
+    };
+
+    // Overlapping notes of every length over four bars, some of them held across
+    // the loop end, with a velocity change now and then
+    std::vector<RecordedNote> makeNotes (int numNotes)
+    {
+        constexpr int64_t loopLength = 16 * ticksPerQuarterNote;
+        juce::Random random (1);
+        std::vector<RecordedNote> notes;
+        notes.reserve ((size_t) numNotes);
+
+        for (int i = 0; i < numNotes; ++i)
+        {
+            const auto start = (int64_t) random.nextInt ((int) loopLength);
+            const auto length = (int64_t) (1 + random.nextInt (2 * ticksPerQuarterNote));
+            const auto velocity = random.nextInt (8) == 0 ? (float) random.nextInt (128) / 127.0f : 0.8f;
+            notes.push_back ({ 24 + random.nextInt (72), velocity, start, (start + length) % loopLength });
+        }
+
+        return notes;
+    }
+
+    void sortNotes (std::vector<RecordedNote>& notes)
+    {
+        std::sort (notes.begin(), notes.end(), [] (const RecordedNote& a, const RecordedNote& b)
+        {
+            return std::tie (a.startTick, a.noteNumber, a.endTick, a.velocity)
+                 < std::tie (b.startTick, b.noteNumber, b.endTick, b.velocity);
+        });
+    }
+
+    bool sameNotes (std::vector<RecordedNote> a, std::vector<RecordedNote> b)
+    {
+        sortNotes (a);
+        sortNotes (b);
+
+        return std::equal (a.begin(), a.end(), b.begin(), b.end(), [] (const RecordedNote& x, const RecordedNote& y)
+        {
+            return x.noteNumber == y.noteNumber && x.velocity == y.velocity
+                && x.startTick == y.startTick && x.endTick == y.endTick;
+        });
+    }
+
+    // Mean microseconds per call of fn over the iterations
+    template <typename Fn>
+    double time (int iterations, Fn&& fn)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < iterations; ++i)
+            fn();
+
+        return std::chrono::duration<double, std::micro> (std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+
+    bool parseOptions (int argc, char* argv[], Options& options)
+    {
+        for (int i = 1; i + 1 < argc; i += 2)
+        {
+            const juce::String arg (argv[i]);
+            const auto value = juce::String (argv[i + 1]).getIntValue();
+
+            if (arg == "--notes")              options.notes = juce::jmax (1, value);
+            else if (arg == "--iterations")    options.iterations = juce::jmax (1, value);
+            else                               return false;
+        }
+
+        return argc % 2 == 1;
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    Options options;
+
+    if (! parseOptions (argc, argv, options))
+    {
+        std::fprintf (stderr, "usage: %s [--notes n] [--iterations n]\n", argv[0]);
+        return 1;
+    }
+
+    // The processor further down starts parameter timers, and they need a message manager
+    juce::MessageManager::getInstance();
+
+    const auto notes = makeNotes (options.notes);
+
+    LoopTimeline timeline;
+    timeline.setNotes (notes);
+
+    // The whole loop as one layer
+    SessionState state;
+    state.layers.resize (1);
+    auto& events = state.layers[0].events;
+    timeline.getEvents (events);
+
+    juce::MemoryBlock blob;
+    const auto encodeMicros = time (options.iterations, [&] { state.writeTo (blob); });
+
+    SessionState decoded;
+    const auto decodeMicros = time (options.iterations, [&] { decoded.readFrom (blob.getData(), blob.getSize()); });
+
+    if (! decoded.readFrom (blob.getData(), blob.getSize()) || decoded.layers.size() != 1)
+    {
+        std::fprintf (stderr, "the state written doesn't read back\n");
+        return 1;
+    }
+
+    const auto& decodedEvents = decoded.layers[0].events;
+    const auto loadMicros = time (options.iterations, [&] { timeline.loadEvents (decodedEvents.data(), (int) decodedEvents.size()); });
+
+    std::vector<RecordedNote> roundTrip;
+    timeline.getNotes (roundTrip);
+    auto ok = sameNotes (notes, roundTrip);
+
+    // The whole path a host takes, including the handover to the audio thread
+    JUCEboxAudioProcessor processor;
+    processor.prepareToPlay (48000.0, 512);
+
+    const auto setMicros = time (options.iterations, [&] { processor.setStateInformation (blob.getData(), (int) blob.getSize()); });
+
+    juce::MemoryBlock saved;
+    const auto getMicros = time (options.iterations, [&] { processor.getStateInformation (saved); });
+
+    // What the processor saved must hold the same loop it was given
+    SessionState reloaded;
+    ok = ok && reloaded.readFrom (saved.getData(), saved.getSize()) && reloaded.layers.size() == 1;
+
+    if (ok)
+    {
+        const auto& reloadedEvents = reloaded.layers[0].events;
+        timeline.loadEvents (reloadedEvents.data(), (int) reloadedEvents.size());
+        timeline.getNotes (roundTrip);
+        ok = sameNotes (notes, roundTrip);
+    }
+
+    const auto numEvents = (double) events.size();
+    std::printf ("%d notes, %d events, %d bytes (%.2f bytes/event)\n",
+                 options.notes, (int) numEvents, (int) blob.getSize(), (double) blob.getSize() / numEvents);
+    std::printf ("%-28s %10s %12s\n", "", "us", "ns/event");
+
+    auto row = [&] (const char* name, double micros) { std::printf ("%-28s %10.1f %12.2f\n", name, micros, micros * 1000.0 / numEvents); };
+    row ("encode", encodeMicros);
+    row ("decode", decodeMicros);
+    row ("load into timeline", loadMicros);
+    row ("setStateInformation", setMicros);
+    row ("getStateInformation", getMicros);
+    std::printf ("round trip: %s\n", ok ? "ok" : "MISMATCH");
+
+    processor.releaseResources();
+    juce::DeletedAtShutdown::deleteAll();
+    juce::MessageManager::deleteInstance();
+    return ok ? 0 : 1;
+}
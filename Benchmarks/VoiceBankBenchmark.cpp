@@ -0,0 +1,103 @@
+// Renders the SoA voice bank at several polyphonies and lane widths and reports
+// the cost per output sample, relative to the scalar (one lane) fallback. It also
+// measures how far SineTable strays from std::sin, and with --accuracy does only
+// that, failing if the error is above SineTable::maxError (ctest runs it so).
+//
+// Standalone, no JUCE needed:
+//   c++ -std=c++17 -O3 -march=native -ISource Benchmarks/VoiceBankBenchmark.cpp -o VoiceBankBenchmark
+
+#include "SineOscillator.h"
+#include "VoiceBank.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+
+namespace
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int blockSize = 512;
+    constexpr double secondsToRender = 10.0;
+
+    template <int LaneWidth>
+    double nanosecondsPerSample (int numVoices)
+    {
+        auto bank = std::make_unique<VoiceBankEngine<LaneWidth>>();
+        bank->prepare (sampleRate, numVoices);
+
+        for (int v = 0; v < numVoices; ++v)
+            bank->noteOn (36 + v % 60, 65.0 * (1.0 + v * 0.37), 0.25f / (float) numVoices);
+
+        std::vector<float> block ((size_t) blockSize);
+        const auto numBlocks = (int) (secondsToRender * sampleRate / blockSize);
+        float checksum = 0.0f;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            std::fill (block.begin(), block.end(), 0.0f);
+            bank->render (block.data(), blockSize);
+            checksum += block[(size_t) (b % blockSize)];
+        }
+
+        const auto elapsed = std::chrono::duration<double, std::nano> (std::chrono::steady_clock::now() - start).count();
+
+        if (checksum == 12345.0f)   // keeps the render from being optimised away
+            std::printf (" ");
+
+        return elapsed / ((double) numBlocks * blockSize);
+    }
+
+    constexpr int numPhases = 50000000;
+
+    // Random phases rather than a grid, so none of them line up with the table's entries
+    double maxSineTableError()
+    {
+        std::mt19937_64 random (1);
+        std::uniform_real_distribution<double> phases (0.0, 1.0);
+        double worst = 0.0;
+
+        for (int i = 0; i < numPhases; ++i)
+        {
+            const auto phase = phases (random);
+            worst = std::max (worst, std::abs ((double) SineTable::lookup (phase) - std::sin (2.0 * 3.141592653589793 * phase)));
+        }
+
+        return worst;
+    }
+
+    void run (int numVoices)
+    {
+        const auto scalar = nanosecondsPerSample<1> (numVoices);
+        const double widths[] = { nanosecondsPerSample<4> (numVoices),
+                                  nanosecondsPerSample<8> (numVoices),
+                                  nanosecondsPerSample<16> (numVoices) };
+
+        std::printf ("%4d voices | scalar %8.2f ns/sample | x4 %8.2f (%.1fx) | x8 %8.2f (%.1fx) | x16 %8.2f (%.1fx)\n",
+                     numVoices, scalar,
+                     widths[0], scalar / widths[0],
+                     widths[1], scalar / widths[1],
+                     widths[2], scalar / widths[2]);
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    const auto error = maxSineTableError();
+    const auto accurate = error <= SineTable::maxError;
+    std::printf ("SineTable worst error against std::sin over %d phases: %.3g (%.1f dB), limit %.3g%s\n",
+                 numPhases, error, 20.0 * std::log10 (error), SineTable::maxError, accurate ? "" : "  FAILED");
+
+    if (argc > 1 && std::strcmp (argv[1], "--accuracy") == 0)
+        return accurate ? 0 : 1;
+
+    std::printf ("VoiceBank render cost, %d-sample blocks at %.0f Hz\n", blockSize, sampleRate);
+
+    for (auto numVoices : { 16, 64, 256 })
+        run (numVoices);
+
+    return accurate ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Fixed-capacity, lock-free queue of small commands from one producer thread to
+// one consumer thread. Used to hand UI actions to the audio thread, which then
+// applies them at the start of a block, so the state they touch only ever has
+// one owner. Nothing here allocates or blocks.
+template <typename Command, int Capacity>
+class CommandQueue
+{
+public:
+    // Producer thread. Returns false if the queue is full.
+    bool push (const Command& command) noexcept
+    {
+        const auto scope = fifo.write (1);
+
+        if (scope.blockSize1 == 0)
+            return false;
+
+        commands[(size_t) scope.startIndex1] = command;
+        return true;
+    }
+
+    // Consumer thread. Calls handler (command) for everything queued so far, in order.
+    template <typename Handler>
+    void drain (Handler&& handler) noexcept
+    {
+        const auto scope = fifo.read (fifo.getNumReady());
+        scope.forEach ([&] (int index) { handler (commands[(size_t) index]); });
+    }
+
+private:
+    juce::AbstractFifo fifo { Capacity + 1 };   // an AbstractFifo holds one less than its size
+    std::array<Command, Capacity + 1> commands {};
+};
@@ -0,0 +1,218 @@
+#include "LoopBouncer.h"
+#include <algorithm>
+#include <cmath>
+
+struct LoopBouncer::Batch
+{
+    Report report;
+    std::atomic<int> remaining { 0 };
+    double startTime = 0.0;
+    Callback onDone;
+
+    void finishJob()
+    {
+        if (--remaining > 0)
+            return;
+
+        report.elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+        for (const auto& result : report.results)
+            report.audioSeconds += result.audioSeconds;
+
+        if (onDone != nullptr)
+            onDone (report);
+    }
+};
+
+class LoopBouncer::BounceJob : public juce::ThreadPoolJob
+{
+public:
+    BounceJob (LoopBouncer& owner, std::shared_ptr<Batch> batchToReport, Job jobToRun, size_t resultIndex)
+        : juce::ThreadPoolJob ("JUCEbox bounce"), bouncer (owner), batch (std::move (batchToReport)),
+          job (std::move (jobToRun)), index (resultIndex) {}
+
+    JobStatus runJob() override
+    {
+        auto* processor = bouncer.takeProcessor();
+        batch->report.results[index] = render (*processor, job, [this] { return shouldExit(); });
+        bouncer.returnProcessor (processor);
+
+        batch->finishJob();
+        return jobHasFinished;
+    }
+
+private:
+    LoopBouncer& bouncer;
+    std::shared_ptr<Batch> batch;
+    Job job;
+    size_t index;
+};
+
+bool LoopBouncer::Report::succeeded() const
+{
+    return std::all_of (results.begin(), results.end(), [] (const Result& r) { return r.succeeded; });
+}
+
+LoopBouncer::LoopBouncer (int threads)
+    : numThreads (juce::jmax (1, threads)),
+      pool (juce::ThreadPoolOptions{}.withThreadName ("JUCEbox bounce")
+                                     .withNumberOfThreads (numThreads))
+{
+}
+
+LoopBouncer::~LoopBouncer()
+{
+    // Renders in progress stop at their next block
+    pool.removeAllJobs (true, 10000);
+}
+
+void LoopBouncer::bounce (std::vector<Job> jobs, Callback onDone)
+{
+    auto batch = std::make_shared<Batch>();
+    batch->report.results.resize (jobs.size());
+    batch->remaining = (int) jobs.size();
+    batch->startTime = juce::Time::getMillisecondCounterHiRes();
+    batch->onDone = std::move (onDone);
+
+    if (jobs.empty())
+    {
+        if (batch->onDone != nullptr)
+            batch->onDone (batch->report);
+
+        return;
+    }
+
+    // Every job running holds a processor, and no more than numThreads run at once,
+    // so that many processors at most are ever needed
+    const auto needed = juce::jmin ((size_t) numThreads, (size_t) pool.getNumJobs() + jobs.size());
+    size_t existing;
+
+    {
+        const juce::ScopedLock lock (processorLock);
+        existing = processors.size();
+    }
+
+    for (auto i = existing; i < needed; ++i)
+    {
+        auto processor = std::make_unique<JUCEboxAudioProcessor>();
+
+        const juce::ScopedLock lock (processorLock);
+        idleProcessors.push_back (processor.get());
+        processors.push_back (std::move (processor));
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+        pool.addJob (new BounceJob (*this, batch, std::move (jobs[i]), i), true);
+}
+
+JUCEboxAudioProcessor* LoopBouncer::takeProcessor()
+{
+    const juce::ScopedLock lock (processorLock);
+    jassert (! idleProcessors.empty());
+
+    auto* processor = idleProcessors.back();
+    idleProcessors.pop_back();
+    return processor;
+}
+
+void LoopBouncer::returnProcessor (JUCEboxAudioProcessor* processor)
+{
+    const juce::ScopedLock lock (processorLock);
+    idleProcessors.push_back (processor);
+}
+
+LoopBouncer::Result LoopBouncer::render (JUCEboxAudioProcessor& processor, const Job& job, const std::function<bool()>& shouldStop)
+{
+    const auto startTime = juce::Time::getMillisecondCounterHiRes();
+    Result result;
+
+    // The loop plays from the top on its own clock, without the metronome, which is
+    // there for whoever is recording
+    auto state = job.state;
+    state.playing = true;
+    state.hostSync = false;
+
+    for (auto& parameter : state.parameters)
+        if (parameter.id == "METRONOME")
+            parameter.value = 0.0f;
+
+    {
+        juce::MemoryBlock data;
+        state.writeTo (data);
+        state = {};
+        processor.setStateInformation (data.getData(), (int) data.getSize());
+    }
+
+    processor.setSynthEngine (job.engine);
+    processor.setNonRealtime (true);
+    processor.setRateAndBufferSizeDetails (job.sampleRate, blockSize);
+    processor.prepareToPlay (job.sampleRate, blockSize);
+
+    // The loop's length in samples, from the parameters the session just set
+    const LoopFileWorker::LoopSettings settings { processor.apvts.getRawParameterValue ("TEMPO")->load(),
+                                                  juce::roundToInt (processor.apvts.getRawParameterValue ("BEATS_PER_BAR")->load()),
+                                                  4,
+                                                  juce::roundToInt (processor.apvts.getRawParameterValue ("NUM_BARS")->load()) };
+    const auto loopSamples = (double) settings.getLoopLengthTicks() * BlockTicks::getSamplesPerTick (job.sampleRate, settings.bpm);
+
+    // Rounded down, so the next time round never starts inside the last block
+    const auto loopedSamples = (int64_t) (loopSamples * juce::jmax (1, job.numLoops));
+    const auto totalSamples = loopedSamples + (int64_t) std::ceil (processor.getTailLengthSeconds() * job.sampleRate);
+    const auto numChannels = processor.getTotalNumOutputChannels();
+
+    // Written beside the target and moved over it, so a failed render leaves the old file alone
+    juce::TemporaryFile temp (job.file);
+    std::unique_ptr<juce::OutputStream> stream (temp.getFile().createOutputStream());
+    std::unique_ptr<juce::AudioFormat> format;
+
+    if (job.file.hasFileExtension ("flac"))
+        format = std::make_unique<juce::FlacAudioFormat>();
+    else
+        format = std::make_unique<juce::WavAudioFormat>();
+
+    std::unique_ptr<juce::AudioFormatWriter> writer;
+
+    if (stream != nullptr)
+        writer = format->createWriterFor (stream, juce::AudioFormatWriterOptions{}.withSampleRate (job.sampleRate)
+                                                                                  .withNumChannels (numChannels)
+                                                                                  .withBitsPerSample (24));
+
+    auto succeeded = writer != nullptr;
+
+    juce::AudioBuffer<float> block (numChannels, blockSize);
+    juce::MidiBuffer midi;
+    int64_t position = 0;
+
+    while (succeeded && position < totalSamples)
+    {
+        if (shouldStop != nullptr && shouldStop())
+        {
+            succeeded = false;
+            break;
+        }
+
+        // Stopping the loop releases its notes, which then ring out through the tail
+        if (position == loopedSamples && processor.getTransportSnapshot().playing)
+            processor.toggleRecording();
+
+        const auto end = position < loopedSamples ? loopedSamples : totalSamples;
+        const auto numSamples = (int) juce::jmin ((int64_t) blockSize, end - position);
+
+        block.setSize (numChannels, numSamples, false, false, true);
+        midi.clear();
+        processor.processBlock (block, midi);
+
+        succeeded = writer->writeFromAudioSampleBuffer (block, 0, numSamples);
+        position += numSamples;
+    }
+
+    processor.releaseResources();
+
+    // Flushes the file before it's moved into place
+    writer.reset();
+
+    result.succeeded = succeeded && temp.overwriteTargetFileWithTemporary();
+    result.audioSeconds = (double) position / job.sampleRate;
+    result.renderSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    return result;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+// Renders loops to WAV or FLAC faster than real time. Each job loads a session
+// into a JUCEboxAudioProcessor of its own and runs processBlock offline, so the
+// file sounds exactly as the loop plays. Jobs are spread over a thread pool with
+// one worker, and one processor, per core, and each file is written block by
+// block as it renders, so memory doesn't grow with the length of a render.
+class LoopBouncer
+{
+public:
+    struct Job
+    {
+        SessionState state;            // played from the top of the loop, whatever its flags say
+        juce::File file;               // FLAC if it ends in .flac, otherwise WAV
+        int numLoops = 1;              // times round the loop, followed by the release tail
+        double sampleRate = 48000.0;
+        JUCEboxAudioProcessor::SynthEngine engine = JUCEboxAudioProcessor::SynthEngine::voiceBank;
+    };
+
+    struct Result
+    {
+        bool succeeded = false;
+        double audioSeconds = 0.0;     // the length of the file
+        double renderSeconds = 0.0;    // rendering and writing it
+    };
+
+    struct Report
+    {
+        std::vector<Result> results;   // in the order the jobs were given
+        double audioSeconds = 0.0;     // over every job
+        double elapsedSeconds = 0.0;   // from bounce() until the last file was written
+
+        bool succeeded() const;
+
+        // How many times faster than real time the batch went, all workers together
+        double getSpeedUp() const      { return elapsedSeconds > 0.0 ? audioSeconds / elapsedSeconds : 0.0; }
+    };
+
+    // Called once per batch, on whichever worker finishes it
+    using Callback = std::function<void (const Report&)>;
+
+    explicit LoopBouncer (int numThreads = juce::SystemStats::getNumCpus());
+    ~LoopBouncer();
+
+    // Queues a batch of jobs. Processors are created here, on the calling thread, as
+    // the pool needs them, and after that go from job to job.
+    void bounce (std::vector<Job> jobs, Callback onDone);
+
+    // One job on the calling thread, with a processor nothing else is using. shouldStop
+    // is polled between blocks; a render it stops leaves the target file alone.
+    static Result render (JUCEboxAudioProcessor& processor, const Job& job, const std::function<bool()>& shouldStop = {});
+
+    static constexpr int blockSize = 512;
+
+private:
+    class BounceJob;
+    struct Batch;
+
+    JUCEboxAudioProcessor* takeProcessor();
+    void returnProcessor (JUCEboxAudioProcessor* processor);
+
+    const int numThreads;
+    juce::CriticalSection processorLock;
+    std::vector<std::unique_ptr<JUCEboxAudioProcessor>> processors;
+    std::vector<JUCEboxAudioProcessor*> idleProcessors;
+
+    // Last, so its workers have stopped before the processors go
+    juce::ThreadPool pool;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LoopBouncer)
+};
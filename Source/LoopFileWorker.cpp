@@ -0,0 +1,211 @@
+#include "LoopFileWorker.h"
+#include <algorithm>
+#include <cmath>
+
+LoopFileWorker::LoopFileWorker() : juce::Thread ("JUCEbox loop files") {}
+
+LoopFileWorker::~LoopFileWorker()
+{
+    stopThread (4000);
+}
+
+void LoopFileWorker::exportLoop (const juce::File& file, std::vector<LoopEvent> events, const LoopSettings& settings, ExportCallback onDone)
+{
+    {
+        const juce::ScopedLock lock (jobLock);
+        jobs.push_back ({ file, false, std::move (events), settings, std::move (onDone), {} });
+    }
+    
+    // Started on first use, so instances that never touch a file cost no thread
+    if (! isThreadRunning())
+        startThread (juce::Thread::Priority::background);
+    
+    notify();
+}
+
+void LoopFileWorker::importLoop (const juce::File& file, ImportCallback onDone)
+{
+    {
+        const juce::ScopedLock lock (jobLock);
+        jobs.push_back ({ file, true, {}, {}, {}, std::move (onDone) });
+    }
+    
+    if (! isThreadRunning())
+        startThread (juce::Thread::Priority::background);
+    
+    notify();
+}
+
+void LoopFileWorker::run()
+{
+    while (! threadShouldExit())
+    {
+        Job job;
+        bool hasJob = false;
+        
+        {
+            const juce::ScopedLock lock (jobLock);
+            
+            if (! jobs.empty())
+            {
+                job = std::move (jobs.front());
+                jobs.pop_front();
+                hasJob = true;
+            }
+        }
+        
+        if (hasJob)
+        {
+            if (job.isImport)
+                runImport (job);
+            else
+                runExport (job);
+        }
+        else
+        {
+            wait (-1);
+        }
+    }
+}
+
+void LoopFileWorker::runExport (Job& job)
+{
+    std::vector<RecordedNote> notes;
+    LoopTimeline::toNotes (job.events, notes);
+    const auto midiFile = createMidiFile (notes, job.settings);
+    
+    // Written beside the target and moved over it, so a failed export leaves the old file alone
+    juce::TemporaryFile temp (job.file);
+    auto succeeded = false;
+    
+    if (auto out = temp.getFile().createOutputStream())
+        succeeded = out->openedOk() && midiFile.writeTo (*out);
+    
+    succeeded = succeeded && temp.overwriteTargetFileWithTemporary();
+    
+    if (job.onExported != nullptr)
+        juce::MessageManager::callAsync ([onDone = std::move (job.onExported), succeeded] { onDone (succeeded); });
+}
+
+void LoopFileWorker::runImport (Job& job)
+{
+    juce::MidiFile midiFile;
+    std::vector<RecordedNote> notes;
+    std::vector<LoopEvent> events;
+    LoopSettings settings;
+    
+    auto succeeded = false;
+    
+    if (auto in = job.file.createInputStream())
+        succeeded = in->openedOk() && midiFile.readFrom (*in) && readMidiFile (midiFile, notes, settings);
+    
+    if (succeeded)
+        LoopTimeline::toEvents (notes, events);
+    
+    if (job.onImported != nullptr)
+        juce::MessageManager::callAsync ([onDone = std::move (job.onImported), succeeded, settings, events = std::move (events)]() mutable
+        {
+            onDone (succeeded, settings, events);
+        });
+}
+
+juce::MidiFile LoopFileWorker::createMidiFile (const std::vector<RecordedNote>& notes, const LoopSettings& settings)
+{
+    const auto loopLength = settings.getLoopLengthTicks();
+    auto end = loopLength;
+    
+    juce::MidiMessageSequence track;
+    track.addEvent (juce::MidiMessage::tempoMetaEvent (juce::roundToInt (60.0e6 / settings.bpm)), 0.0);
+    track.addEvent (juce::MidiMessage::timeSignatureMetaEvent (settings.beatsPerBar, settings.beatUnit), 0.0);
+    
+    for (const auto& note : notes)
+    {
+        // A note held across the loop end is written running on past it
+        const auto endTick = note.endTick < note.startTick ? note.endTick + loopLength : note.endTick;
+        end = juce::jmax (end, endTick);
+        
+        track.addEvent (juce::MidiMessage::noteOn (1, note.noteNumber, note.velocity), (double) note.startTick);
+        track.addEvent (juce::MidiMessage::noteOff (1, note.noteNumber), (double) endTick);
+    }
+    
+    track.addEvent (juce::MidiMessage::endOfTrack(), (double) end);
+    
+    juce::MidiFile midiFile;
+    midiFile.setTicksPerQuarterNote (ticksPerQuarterNote);
+    midiFile.addTrack (track);
+    return midiFile;
+}
+
+bool LoopFileWorker::readMidiFile (const juce::MidiFile& midiFile, std::vector<RecordedNote>& notes, LoopSettings& settings)
+{
+    settings = {};
+    
+    juce::MidiMessageSequence tempos, signatures;
+    midiFile.findAllTempoEvents (tempos);
+    midiFile.findAllTimeSigEvents (signatures);
+    
+    if (tempos.getNumEvents() > 0)
+    {
+        const auto secondsPerQuarterNote = tempos.getEventPointer (0)->message.getTempoSecondsPerQuarterNote();
+        
+        if (secondsPerQuarterNote > 0.0)
+            settings.bpm = 60.0 / secondsPerQuarterNote;
+    }
+    
+    // 6/8 becomes a bar of three quarter notes; odd meters round to the nearest
+    if (signatures.getNumEvents() > 0)
+    {
+        int numerator = 4, denominator = 4;
+        signatures.getEventPointer (0)->message.getTimeSignatureInfo (numerator, denominator);
+        
+        if (numerator > 0 && denominator > 0)
+            settings.beatsPerBar = juce::jlimit (1, LoopSettings::maxBeatsPerBar, juce::roundToInt (numerator * 4.0 / denominator));
+    }
+    
+    // SMPTE files are timed in seconds, which only map onto beats at one tempo
+    auto file = midiFile;
+    double scale = (double) ticksPerQuarterNote / file.getTimeFormat();
+    
+    if (file.getTimeFormat() <= 0)
+    {
+        file.convertTimestampTicksToSeconds();
+        scale = settings.bpm / 60.0 * ticksPerQuarterNote;
+    }
+    
+    notes.clear();
+    int64_t lastTick = 0;
+    
+    for (int t = 0; t < file.getNumTracks(); ++t)
+    {
+        juce::MidiMessageSequence track (*file.getTrack (t));
+        track.updateMatchedPairs();
+        
+        for (const auto* event : track)
+        {
+            if (! event->message.isNoteOn())
+                continue;
+            
+            const auto start = (int64_t) std::llround (event->message.getTimeStamp() * scale);
+            const auto end = event->noteOffObject != nullptr ? (int64_t) std::llround (event->noteOffObject->message.getTimeStamp() * scale)
+                                                             : start + ticksPerQuarterNote;
+            
+            notes.push_back ({ event->message.getNoteNumber(), event->message.getFloatVelocity(), start, end });
+            lastTick = juce::jmax (lastTick, end);
+        }
+    }
+    
+    // As many whole bars as the notes need, up to the longest loop the looper has.
+    // Anything past that is cut, and notes running over the end wrap round.
+    const auto ticksPerBar = (int64_t) settings.beatsPerBar * ticksPerQuarterNote;
+    settings.numBars = (int) juce::jlimit ((int64_t) 1, (int64_t) LoopSettings::maxBars, (lastTick + ticksPerBar - 1) / ticksPerBar);
+    
+    const auto loopLength = settings.getLoopLengthTicks();
+    
+    notes.erase (std::remove_if (notes.begin(), notes.end(), [&] (const RecordedNote& n) { return n.startTick >= loopLength; }), notes.end());
+    
+    for (auto& note : notes)
+        if (note.endTick >= loopLength)
+            note.endTick = juce::jmin (note.endTick, note.startTick + loopLength - 1) % loopLength;
+    
+    return ! notes.empty();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <JuceHeader.h>
+#include "LoopTimeline.h"
+#include <deque>
+#include <functional>
+
+// Reads and writes the loop as a Standard MIDI File on a background thread, so
+// parsing, sorting and disk access never hold up the message thread.
+class LoopFileWorker : private juce::Thread
+{
+public:
+    // The musical frame of a loop. Imported loops always count in quarter notes,
+    // since the looper's own time signature is beats per bar over four.
+    struct LoopSettings
+    {
+        static constexpr int maxBeatsPerBar = 16, maxBars = 16;   // the parameters' ranges
+
+        double bpm = 120.0;
+        int beatsPerBar = 4;
+        int beatUnit = 4;
+        int numBars = 4;
+
+        int64_t getLoopLengthTicks() const { return (int64_t) beatsPerBar * numBars * ticksPerQuarterNote * 4 / beatUnit; }
+    };
+
+    // Called on the message thread once the file has been written or read. An
+    // import's events are in time order, each note with its own id.
+    using ExportCallback = std::function<void (bool succeeded)>;
+    using ImportCallback = std::function<void (bool succeeded, const LoopSettings&, std::vector<LoopEvent>& events)>;
+
+    LoopFileWorker();
+    ~LoopFileWorker() override;
+
+    // Call these from the message thread
+    void exportLoop (const juce::File& file, std::vector<LoopEvent> events, const LoopSettings& settings, ExportCallback onDone);
+    void importLoop (const juce::File& file, ImportCallback onDone);
+
+    // The conversions themselves, usable from any thread
+    static juce::MidiFile createMidiFile (const std::vector<RecordedNote>& notes, const LoopSettings& settings);
+    static bool readMidiFile (const juce::MidiFile& midiFile, std::vector<RecordedNote>& notes, LoopSettings& settings);
+
+private:
+    struct Job
+    {
+        juce::File file;
+        bool isImport;
+        std::vector<LoopEvent> events;
+        LoopSettings settings;
+        ExportCallback onExported;
+        ImportCallback onImported;
+    };
+
+    void run() override;
+    void runExport (Job& job);
+    void runImport (Job& job);
+
+    juce::CriticalSection jobLock;
+    std::deque<Job> jobs;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LoopFileWorker)
+};
@@ -0,0 +1,335 @@
+#include "LoopHistory.h"
+
+LoopHistory::LoopHistory() : juce::Thread ("JUCEbox loop history")
+{
+    history.emplace_back();
+    publish();
+}
+
+LoopHistory::~LoopHistory()
+{
+    stopThread (4000);
+
+    // The audio thread has stopped by now, so the buffers are all ours
+    finishedTakes.drain ([] (const FinishedTake& take) { delete take.events; });
+    delete spareBuffer.exchange (nullptr);
+}
+
+void LoopHistory::reset (std::vector<LoopVersion::Entry> layers)
+{
+    const juce::ScopedLock lock (historyLock);
+
+    // Takes recorded before the session was loaded don't belong on top of it
+    discardTakesUpTo = lastSubmittedTake.load();
+
+    history.clear();
+    history.push_back (std::move (layers));
+    position = 0;
+    lastVolumeLayer = -1;
+    publish();
+}
+
+void LoopHistory::replace (std::vector<LoopVersion::Entry> layers)
+{
+    const juce::ScopedLock lock (historyLock);
+    commit (std::move (layers));
+}
+
+void LoopHistory::setLayerMuted (int index, bool muted)
+{
+    const juce::ScopedLock lock (historyLock);
+    auto layers = history[position];
+
+    if (juce::isPositiveAndBelow (index, (int) layers.size()) && layers[(size_t) index].muted != muted)
+    {
+        layers[(size_t) index].muted = muted;
+        commit (std::move (layers));
+    }
+}
+
+void LoopHistory::setLayerVolume (int index, float volume)
+{
+    const juce::ScopedLock lock (historyLock);
+    auto layers = history[position];
+
+    if (juce::isPositiveAndBelow (index, (int) layers.size()))
+    {
+        layers[(size_t) index].volume = juce::jlimit (0.0f, 1.0f, volume);
+        commit (std::move (layers), true, index);
+    }
+}
+
+bool LoopHistory::undo()
+{
+    const juce::ScopedLock lock (historyLock);
+
+    if (position == 0)
+        return false;
+
+    --position;
+    lastVolumeLayer = -1;
+    publish();
+    return true;
+}
+
+bool LoopHistory::redo()
+{
+    const juce::ScopedLock lock (historyLock);
+
+    if (position + 1 >= history.size())
+        return false;
+
+    ++position;
+    lastVolumeLayer = -1;
+    publish();
+    return true;
+}
+
+bool LoopHistory::canUndo() const
+{
+    const juce::ScopedLock lock (historyLock);
+    return position > 0;
+}
+
+bool LoopHistory::canRedo() const
+{
+    const juce::ScopedLock lock (historyLock);
+    return position + 1 < history.size();
+}
+
+std::vector<LoopHistory::LayerInfo> LoopHistory::getLayers() const
+{
+    const juce::ScopedLock lock (historyLock);
+    std::vector<LayerInfo> layers;
+
+    for (const auto& entry : history[position])
+        layers.push_back ({ (int) entry.layer->events.size(), entry.volume, entry.muted });
+
+    return layers;
+}
+
+std::shared_ptr<const LoopVersion> LoopHistory::getLatestVersion() const
+{
+    return std::atomic_load (&latest);
+}
+
+void LoopHistory::commit (std::vector<LoopVersion::Entry> layers, bool isVolumeChange, int layerIndex)
+{
+    // A run of volume changes to one layer replaces its own last step
+    const auto merge = isVolumeChange && layerIndex == lastVolumeLayer && position > 0;
+
+    if (! merge)
+        ++position;
+
+    // A new edit drops whatever could have been redone
+    history.resize (position);
+    history.push_back (std::move (layers));
+    lastVolumeLayer = isVolumeChange ? layerIndex : -1;
+    publish();
+}
+
+void LoopHistory::publish()
+{
+    auto version = std::make_shared<LoopVersion>();
+    version->layers = history[position];
+    version->serial = nextSerial++;
+    version->takeSerial = takeSerial;
+
+    for (const auto& entry : version->layers)
+        if (entry.layer.get() == takeLayer)
+            version->takeLayer = takeLayer;
+
+    // If the last version published is still pending, the audio thread never
+    // took it and now never will, so it can go straight away
+    if (auto* unclaimed = pending.exchange (version.get()))
+    {
+        jassert (published.back().get() == unclaimed);
+        published.pop_back();
+    }
+
+    std::atomic_store (&latest, std::shared_ptr<const LoopVersion> (version));
+    published.push_back (std::move (version));
+    ++revision;
+
+    freeUnusedVersions();
+}
+
+void LoopHistory::freeUnusedVersions()
+{
+    // Serials only go up, so everything older than what the audio thread last
+    // took is done with. The newest is always kept for getLatestVersion().
+    const auto inUse = acknowledgedSerial.load();
+
+    while (published.size() > 1 && published.front()->serial < inUse)
+        published.pop_front();
+}
+
+void LoopHistory::setTakeCapacity (int maxEvents)
+{
+    takeCapacity.store (juce::jmax (2, maxEvents));
+}
+
+void LoopHistory::expectTake()
+{
+    startIfNeeded();
+    notify();
+}
+
+void LoopHistory::startIfNeeded()
+{
+    // Started on first use, so instances that never record cost no thread
+    if (! isThreadRunning())
+        startThread (juce::Thread::Priority::normal);
+}
+
+uint64_t LoopHistory::submitTake (const LoopTimeline& take) noexcept
+{
+    auto* events = spareBuffer.exchange (nullptr);
+
+    if (events == nullptr)
+        return 0;
+
+    // Reserved up front, so the copy never allocates
+    if ((int) events->capacity() < take.getNumEvents())
+    {
+        takeCapacity.store (juce::jmax (takeCapacity.load(), take.getNumEvents()));
+        spareBuffer.store (events);
+        return 0;
+    }
+
+    take.getEvents (*events);
+
+    const auto serial = lastSubmittedTake.load() + 1;
+
+    if (! finishedTakes.push ({ events, serial }))
+    {
+        spareBuffer.store (events);
+        return 0;
+    }
+
+    lastSubmittedTake.store (serial);
+    return serial;
+}
+
+void LoopHistory::submitClear() noexcept
+{
+    const auto serial = lastSubmittedTake.load() + 1;
+
+    // Eight slots is far more than anyone can click between two blocks
+    if (! finishedTakes.push ({ nullptr, serial }))
+        jassertfalse;
+
+    lastSubmittedTake.store (serial);
+}
+
+void LoopHistory::run()
+{
+    uint32_t pollUntil = 0;
+
+    while (! threadShouldExit())
+    {
+        refillSpareBuffer();
+        finishedTakes.drain ([this] (const FinishedTake& take) { addTake (take); });
+
+        {
+            const juce::ScopedLock lock (historyLock);
+            freeUnusedVersions();
+        }
+
+        // A short poll while there's a take about (and for a while after being told
+        // to expect one) keeps the handover quick without waking idle instances at all
+        const auto polling = takeActive.load() || juce::Time::getMillisecondCounter() < pollUntil;
+
+        if (wait (polling ? 5 : -1))
+            pollUntil = juce::Time::getMillisecondCounter() + 1000;
+    }
+}
+
+void LoopHistory::refillSpareBuffer()
+{
+    const auto capacity = (size_t) takeCapacity.load();
+    auto* spare = spareBuffer.exchange (nullptr);
+
+    if (spare == nullptr || spare->capacity() < capacity)
+    {
+        delete spare;
+        spare = new std::vector<LoopEvent>();
+        spare->reserve (capacity);
+    }
+
+    spareBuffer.store (spare);
+}
+
+void LoopHistory::addTake (const FinishedTake& take)
+{
+    std::unique_ptr<std::vector<LoopEvent>> events (take.events);
+    const juce::ScopedLock lock (historyLock);
+
+    if (take.serial <= discardTakesUpTo)
+        return;
+
+    takeSerial = take.serial;
+    takeLayer = nullptr;
+
+    if (events == nullptr)
+    {
+        commit ({});
+        return;
+    }
+
+    // An empty take adds nothing, but the audio thread is still waiting to hear it's been dealt with
+    if (events->empty())
+    {
+        publish();
+        return;
+    }
+
+    // The layer gets a copy sized to fit; the buffer itself is reserved for a whole take
+    auto layer = std::make_shared<LoopLayer>();
+    layer->events.assign (events->begin(), events->end());
+    takeLayer = layer.get();
+
+    auto layers = history[position];
+
+    // At the limit the two oldest layers that are both muted or both playing are mixed
+    // down into one, with their volumes baked into the velocities, so a muted layer is
+    // never lost into one that plays. The history still has them apart, for undo.
+    if ((int) layers.size() >= LoopVersion::maxLayers)
+    {
+        for (size_t first = 0; first < layers.size(); ++first)
+        {
+            const auto muted = layers[first].muted;
+            auto second = first + 1;
+
+            while (second < layers.size() && layers[second].muted != muted)
+                ++second;
+
+            if (second == layers.size())
+                continue;
+
+            LoopVersion pair;
+            pair.layers = { layers[first], layers[second] };
+
+            auto merged = std::make_shared<LoopLayer>();
+            pair.flatten (merged->events, true);
+
+            layers.erase (layers.begin() + (std::ptrdiff_t) second);
+            layers[first] = { std::move (merged), 1.0f, muted };
+            break;
+        }
+    }
+
+    layers.push_back ({ std::move (layer), 1.0f, false });
+    commit (std::move (layers));
+
+    // Handed back to the audio thread to take the next take in
+    if (spareBuffer.load() == nullptr)
+    {
+        auto* spare = events.release();
+        spare->clear();
+
+        std::vector<LoopEvent>* expected = nullptr;
+        if (! spareBuffer.compare_exchange_strong (expected, spare))
+            delete spare;
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <JuceHeader.h>
+#include "CommandQueue.h"
+#include "LoopLayers.h"
+#include <deque>
+
+// The looper's layers and their undo history, kept off the audio thread.
+//
+// Every change builds a new immutable LoopVersion and publishes it through an
+// atomic pointer, which the audio thread exchanges for null at the start of a
+// block. The audio thread then acknowledges the serial of the version it plays;
+// versions with older serials can't be in use any more and are freed here, on
+// whichever thread publishes next, so the audio thread never frees anything.
+//
+// A take the audio thread has finished recording comes the other way: it copies
+// the take into a spare buffer this class keeps ready, queues it, and a
+// background thread turns it into a new layer on top of the current version.
+class LoopHistory : private juce::Thread
+{
+public:
+    struct LayerInfo
+    {
+        int numEvents;
+        float volume;
+        bool muted;
+    };
+
+    LoopHistory();
+    ~LoopHistory() override;
+
+    // Message thread. Each of these publishes a new version and, apart from
+    // reset(), can be undone. Volume changes to the same layer in a row are
+    // one step, so dragging a slider doesn't fill the history.
+    void reset (std::vector<LoopVersion::Entry> layers);   // for a loaded session; forgets the history
+    void replace (std::vector<LoopVersion::Entry> layers);
+    void setLayerMuted (int index, bool muted);
+    void setLayerVolume (int index, float volume);
+    bool undo();
+    bool redo();
+
+    bool canUndo() const;
+    bool canRedo() const;
+    std::vector<LayerInfo> getLayers() const;
+
+    // Any thread. Doesn't take historyLock, so it never waits on a take being folded in.
+    std::shared_ptr<const LoopVersion> getLatestVersion() const;
+
+    // Goes up with every change, so the editor can tell when to redraw
+    int getRevision() const { return revision.load(); }
+
+    // Message thread. Takes are copied into spare buffers of this many events
+    void setTakeCapacity (int maxEvents);
+
+    // Message thread: a take, or a clearLoop(), may be on its way from the audio
+    // thread, so the background thread should look out for it
+    void expectTake();
+
+    // Audio thread. Returns the newest version if there's one it hasn't had yet.
+    const LoopVersion* takeNewVersion() noexcept
+    {
+        auto* version = pending.exchange (nullptr);
+
+        if (version != nullptr)
+            acknowledgedSerial.store (version->serial);
+
+        return version;
+    }
+
+    // Audio thread. Copies the take's events out and queues them to become a layer.
+    // Returns the take's serial, to look for in LoopVersion::takeSerial, or 0 if
+    // there's no buffer ready for it yet, in which case try again next block.
+    uint64_t submitTake (const LoopTimeline& take) noexcept;
+
+    // Audio thread. Queues an undoable clear behind any takes already submitted.
+    void submitClear() noexcept;
+
+    // Audio thread. Whether a take is being recorded or waiting to become a layer;
+    // while it is, the background thread looks for takes every few milliseconds.
+    void setTakeActive (bool isActive) noexcept   { takeActive.store (isActive); }
+
+private:
+    struct FinishedTake
+    {
+        std::vector<LoopEvent>* events;   // null for a clear
+        uint64_t serial;
+    };
+
+    void run() override;
+    void refillSpareBuffer();
+    void addTake (const FinishedTake& take);
+    void startIfNeeded();
+
+    // These expect historyLock to be held
+    void commit (std::vector<LoopVersion::Entry> layers, bool isVolumeChange = false, int layerIndex = -1);
+    void publish();
+    void freeUnusedVersions();
+
+    juce::CriticalSection historyLock;
+    std::vector<std::vector<LoopVersion::Entry>> history;   // every state of the layers, oldest first
+    size_t position = 0;                                    // the one playing
+    int lastVolumeLayer = -1;                               // for merging a run of volume changes
+    uint64_t nextSerial = 1;
+    uint64_t takeSerial = 0;                                // the last take folded in
+    uint64_t discardTakesUpTo = 0;
+    const LoopLayer* takeLayer = nullptr;
+    std::deque<std::shared_ptr<const LoopVersion>> published;   // kept until the audio thread is past them
+    std::shared_ptr<const LoopVersion> latest;                   // only through std::atomic_load/store
+    std::atomic<int> revision { 0 };
+
+    std::atomic<const LoopVersion*> pending { nullptr };
+    std::atomic<uint64_t> acknowledgedSerial { 0 };
+
+    // Takes, audio thread to background thread
+    std::atomic<std::vector<LoopEvent>*> spareBuffer { nullptr };
+    std::atomic<int> takeCapacity { LoopTimeline::defaultCapacity };
+    std::atomic<uint64_t> lastSubmittedTake { 0 };
+    std::atomic<bool> takeActive { false };
+    CommandQueue<FinishedTake, 8> finishedTakes;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LoopHistory)
+};
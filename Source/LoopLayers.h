@@ -0,0 +1,284 @@
+#pragma once
+#include <JuceHeader.h>
+#include "LoopTimeline.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <unordered_set>
+
+// One overdub pass, frozen: its events in time order with a note-on and its
+// note-off sharing an id. Never changed once built, so any number of versions
+// of the loop can share it.
+struct LoopLayer
+{
+    std::vector<LoopEvent> events;
+};
+
+// An immutable snapshot of the whole loop: its layers and how each is mixed.
+// An edit builds a new version that shares every layer it doesn't touch, so
+// even on a loop of many thousands of events it only copies a few pointers.
+struct LoopVersion
+{
+    // The audio thread keeps a cursor per layer in fixed storage
+    static constexpr int maxLayers = 32;
+
+    struct Entry
+    {
+        std::shared_ptr<const LoopLayer> layer;
+        float volume = 1.0f;   // scales the layer's velocities
+        bool muted = false;
+    };
+
+    // A note-on quieter than MIDI velocity 1 would go out as velocity 0, which
+    // means note-off, so layers turned down that far leave such notes out
+    static bool isAudible (float velocity) noexcept   { return velocity * 127.0f >= 0.5f; }
+
+    std::vector<Entry> layers;
+    uint64_t serial = 0;                  // counts up with every version published
+    uint64_t takeSerial = 0;              // the last recorded take that has been dealt with
+    const LoopLayer* takeLayer = nullptr; // the layer that take became, if it's still here
+
+    // Every unmuted layer's events (or every layer's, with includeMuted) in one
+    // time-ordered list, with velocities scaled by the layer volumes and ids
+    // renumbered so no two layers' notes collide. Notes the volume makes
+    // inaudible are left out, as LayerPlayer leaves them out.
+    void flatten (std::vector<LoopEvent>& out, bool includeMuted = false) const
+    {
+        // Ties sort as LoopTimeline::toEvents() sorts them: releases before note-ons, so
+        // a note one layer restarts on the tick another releases it keeps sounding,
+        // except for a note that ends on the tick it starts
+        struct Keyed { LoopEvent event; int rank; };
+        std::vector<Keyed> keyed;
+        std::vector<uint32_t> startedThisTick;
+        std::unordered_set<uint32_t> silent;
+        uint32_t idOffset = 0;
+
+        for (const auto& entry : layers)
+        {
+            uint32_t maxId = 0;
+            auto tick = std::numeric_limits<int64_t>::min();
+            startedThisTick.clear();
+            silent.clear();
+
+            for (auto e : entry.layer->events)
+            {
+                maxId = juce::jmax (maxId, e.noteId);
+
+                if (e.isNoteOn && ! isAudible (e.velocity * entry.volume))
+                {
+                    silent.insert (e.noteId);
+                    continue;
+                }
+
+                if (! e.isNoteOn && silent.erase (e.noteId) > 0)
+                    continue;
+
+                if (e.time != tick)
+                {
+                    tick = e.time;
+                    startedThisTick.clear();
+                }
+
+                auto rank = 0;
+
+                if (e.isNoteOn)
+                {
+                    startedThisTick.push_back (e.noteId);
+                    rank = 1;
+                }
+                else if (std::find (startedThisTick.begin(), startedThisTick.end(), e.noteId) != startedThisTick.end())
+                {
+                    rank = 2;
+                }
+
+                e.noteId += idOffset;
+                e.velocity *= entry.volume;
+
+                if (includeMuted || ! entry.muted)
+                    keyed.push_back ({ e, rank });
+            }
+
+            idOffset += maxId;
+        }
+
+        // Stable, so each layer's own order of events of the same kind on a tick is kept
+        std::stable_sort (keyed.begin(), keyed.end(), [] (const Keyed& a, const Keyed& b)
+        {
+            return a.event.time != b.event.time ? a.event.time < b.event.time : a.rank < b.rank;
+        });
+
+        out.clear();
+        out.reserve (keyed.size());
+        for (const auto& k : keyed)
+            out.push_back (k.event);
+    }
+};
+
+// Plays a LoopVersion on the audio thread. Each layer has its own cursor, so
+// playback costs the same per event however many layers there are, and nothing
+// here allocates, frees or changes a layer.
+class LayerPlayer
+{
+public:
+    const LoopVersion* getVersion() const noexcept { return version; }
+
+    // Switches to `next`. Layers both versions share keep their place and their
+    // sounding notes. Layers that are gone, or newly muted, release theirs through
+    // callback (event); layers new to this version pick up from `time`.
+    template <typename Callback>
+    void setVersion (const LoopVersion* next, int64_t time, Callback&& callback) noexcept
+    {
+        auto& current = states[(size_t) active];
+        auto& incoming = states[(size_t) (1 - active)];
+        const auto numNext = next != nullptr ? juce::jmin ((int) next->layers.size(), LoopVersion::maxLayers) : 0;
+
+        for (int i = 0; i < numNext; ++i)
+        {
+            const auto& entry = next->layers[(size_t) i];
+            auto& state = incoming[(size_t) i];
+            auto* previous = findState (entry.layer.get());
+
+            if (previous != nullptr)
+            {
+                state = *previous;
+                previous->layer = nullptr;   // claimed, so it isn't released below
+            }
+            else
+            {
+                state = {};
+                state.layer = entry.layer.get();
+                state.cursor = findCursor (*state.layer, time);
+            }
+
+            state.volume = entry.volume;
+            state.muted = entry.muted;
+
+            if (state.muted)
+                release (state, time, callback);
+        }
+
+        for (int i = 0; i < numLayers; ++i)
+            if (current[(size_t) i].layer != nullptr)
+                release (current[(size_t) i], time, callback);
+
+        active = 1 - active;
+        numLayers = numNext;
+        version = next;
+    }
+
+    // Marks the notes a LoopTimeline handed over as sounding in `layer`, which
+    // holds the same events. Returns false if this version doesn't have it.
+    bool adoptSoundingNotes (const LoopLayer* layer, const std::array<uint32_t, 128>& sounding) noexcept
+    {
+        auto* state = findState (layer);
+
+        if (state == nullptr || state->muted)
+            return false;
+
+        for (size_t n = 0; n < 128; ++n)
+            if (sounding[n] != 0)
+                state->soundingNoteIds[n] = sounding[n];
+
+        return true;
+    }
+
+    // Calls callback (event, volume) for every event due before endTime, layer by layer
+    template <typename Callback>
+    void playUntil (int64_t endTime, Callback&& callback) noexcept
+    {
+        for (int i = 0; i < numLayers; ++i)
+        {
+            auto& state = states[(size_t) active][(size_t) i];
+            const auto& events = state.layer->events;
+            const auto size = (int) events.size();
+
+            for (; state.cursor < size && events[(size_t) state.cursor].time < endTime; ++state.cursor)
+            {
+                const auto& e = events[(size_t) state.cursor];
+                auto& sounding = state.soundingNoteIds[e.noteNumber];
+
+                if (state.muted)
+                    continue;
+
+                // A note-off whose note-on was skipped, by a seek or for being too quiet
+                // to play, has nothing to stop
+                if (e.isNoteOn)
+                {
+                    if (! LoopVersion::isAudible (e.velocity * state.volume))
+                        continue;
+
+                    sounding = e.noteId;
+                }
+                else if (sounding == e.noteId)
+                    sounding = 0;
+                else
+                    continue;
+
+                callback (e, state.volume);
+            }
+        }
+    }
+
+    void rewind() noexcept
+    {
+        for (int i = 0; i < numLayers; ++i)
+            states[(size_t) active][(size_t) i].cursor = 0;
+    }
+
+    // As LoopTimeline::seek(): sounding notes are released through callback (event)
+    template <typename Callback>
+    void seek (int64_t time, Callback&& callback) noexcept
+    {
+        for (int i = 0; i < numLayers; ++i)
+        {
+            auto& state = states[(size_t) active][(size_t) i];
+            release (state, time, callback);
+            state.cursor = findCursor (*state.layer, time);
+        }
+    }
+
+private:
+    struct LayerState
+    {
+        const LoopLayer* layer = nullptr;
+        int cursor = 0;
+        float volume = 1.0f;
+        bool muted = false;
+        std::array<uint32_t, 128> soundingNoteIds {};
+    };
+
+    LayerState* findState (const LoopLayer* layer) noexcept
+    {
+        for (int i = 0; i < numLayers; ++i)
+            if (states[(size_t) active][(size_t) i].layer == layer)
+                return &states[(size_t) active][(size_t) i];
+
+        return nullptr;
+    }
+
+    static int findCursor (const LoopLayer& layer, int64_t time) noexcept
+    {
+        const auto it = std::lower_bound (layer.events.begin(), layer.events.end(), time,
+                                          [] (const LoopEvent& e, int64_t t) { return e.time < t; });
+        return (int) (it - layer.events.begin());
+    }
+
+    template <typename Callback>
+    static void release (LayerState& state, int64_t time, Callback& callback) noexcept
+    {
+        for (int n = 0; n < 128; ++n)
+        {
+            if (state.soundingNoteIds[(size_t) n] != 0)
+            {
+                state.soundingNoteIds[(size_t) n] = 0;
+                callback (LoopEvent { time, 0.0f, 0, (uint8_t) n, false }, 1.0f);
+            }
+        }
+    }
+
+    // The states for the version playing and scratch for building the next one's
+    std::array<std::array<LayerState, LoopVersion::maxLayers>, 2> states {};
+    int active = 0;
+    int numLayers = 0;
+    const LoopVersion* version = nullptr;
+};
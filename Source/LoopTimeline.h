@@ -0,0 +1,497 @@
+#pragma once
+#include <JuceHeader.h>
+#include <unordered_map>
+
+// Loop times are in ticks, a fixed fraction of a beat, so the recorded loop
+// doesn't depend on the tempo or the sample rate
+static constexpr int ticksPerQuarterNote = 960;
+
+struct RecordedNote
+{
+    int noteNumber;
+    float velocity;
+    int64_t startTick;
+    int64_t endTick;
+};
+
+struct LoopEvent
+{
+    int64_t time;        // ticks from the start of the loop
+    float velocity;
+    uint32_t noteId;     // shared by a note-on and its note-off
+    uint8_t noteNumber;
+    bool isNoteOn;
+};
+
+// Maps a run of a block's samples onto loop ticks at the block's tempo. It's
+// rebuilt for every block, so a tempo or sample rate change only changes this
+// mapping and never touches the recorded events. A block that wraps the loop is
+// split into one of these per cycle; offsets are always relative to the block.
+struct BlockTicks
+{
+    double startTick = 0.0;
+    double samplesPerTick = 1.0;
+    int numSamples = 0;
+    int startSample = 0;
+    
+    static double getSamplesPerTick (double sampleRate, double bpm)
+    {
+        return sampleRate * 60.0 / (bpm * ticksPerQuarterNote);
+    }
+    
+    double getEndTick() const                   { return startTick + numSamples / samplesPerTick; }
+    int getEndSample() const                    { return startSample + numSamples; }
+    
+    // Every whole tick before this one falls inside the block
+    int64_t getEndTickCeiling() const           { return (int64_t) std::ceil (getEndTick()); }
+    
+    double getTickAt (int sampleOffset) const   { return startTick + (sampleOffset - startSample) / samplesPerTick; }
+    
+    // The first sample at or after the tick, clamped to the block
+    int getSampleOffset (double tick) const
+    {
+        const auto offset = std::ceil ((tick - startTick) * samplesPerTick);
+        return startSample + (int) juce::jlimit (0.0, (double) juce::jmax (0, numSamples - 1), offset);
+    }
+    
+    // Cuts this run at the first sample whose tick is at or after `tick` and
+    // returns the rest, with ticks counted on from `tick` again. Returns an empty
+    // run if every sample is before `tick`.
+    BlockTicks splitAt (double tick)
+    {
+        const auto local = (int) juce::jlimit (0.0, (double) numSamples, std::ceil ((tick - startTick) * samplesPerTick));
+        
+        BlockTicks rest { getTickAt (startSample + local) - tick, samplesPerTick, numSamples - local, startSample + local };
+        numSamples = local;
+        return rest;
+    }
+};
+
+// The recorded loop as a flat list of note-on / note-off events in time order,
+// stored in a fixed-capacity ring that is allocated up front.
+//
+// The front of the ring is the playback cursor: the next event due. Playing an
+// event rotates it to the back, so the ring always holds the events still to
+// come this cycle followed by the ones already played. Recording pushes onto the
+// back, which is exactly "now" in that order, so recording and playback are both
+// O(1) per event and wrapping the loop costs nothing. Nothing here allocates
+// except setCapacity().
+class LoopTimeline
+{
+public:
+    enum class OverflowPolicy
+    {
+        dropNewest,     // ignore notes that don't fit
+        dropOldest,     // evict the note that has gone longest without being played or recorded
+        stopRecording   // recordNoteOn() returns false and the caller stops recording
+    };
+
+    static constexpr int defaultCapacity = 65536;
+
+    LoopTimeline() { setCapacity (defaultCapacity); }
+
+    // Not real-time safe: reallocates the ring, keeping as many events as fit.
+    void setCapacity (int newCapacity)
+    {
+        jassert (newCapacity > 0);
+
+        std::vector<LoopEvent> newEvents ((size_t) newCapacity);
+        const auto kept = juce::jmin (count, newCapacity);
+
+        for (int i = 0; i < kept; ++i)
+            newEvents[(size_t) i] = at (i);
+
+        played = juce::jmax (0, played - (count - kept));
+        events.swap (newEvents);
+        head = 0;
+        count = kept;
+    }
+
+    int getCapacity() const { return (int) events.size(); }
+    void setOverflowPolicy (OverflowPolicy newPolicy) { policy = newPolicy; }
+
+    void clear()
+    {
+        head = 0;
+        count = 0;
+        played = 0;
+        heldNotes = {};
+        numHeld = 0;
+        droppedNoteIds = {};
+        soundingNoteIds = {};
+        pendingReleases = {};
+        numPendingReleases = 0;
+    }
+
+    bool isEmpty() const { return count == 0; }
+    int getNumEvents() const { return count; }
+
+    // Puts the cursor back on the first event of the loop. Anything not yet
+    // played (events beyond the loop end) is moved behind it.
+    void rewind()
+    {
+        rotate (count - played);
+        played = 0;
+    }
+
+    // Calls callback (event) for every event due before endTime, in order, and moves
+    // the cursor past them. Notes released by an eviction are reported first. The
+    // note-on of a note still held while recording is passed over, since the player
+    // is holding it: playing it again when the loop wraps would retrigger the note.
+    template <typename Callback>
+    void playUntil (int64_t endTime, Callback&& callback)
+    {
+        flushPendingReleases (endTime, callback);
+
+        while (played < count && front().time < endTime)
+        {
+            const auto e = front();
+
+            if (droppedNoteIds[e.noteNumber] == e.noteId)
+            {
+                droppedNoteIds[e.noteNumber] = 0;
+                popFront();
+                continue;
+            }
+
+            const auto& slot = heldNotes[e.noteNumber];
+
+            if (! (e.isNoteOn && slot.held && slot.noteId == e.noteId))
+            {
+                soundingNoteIds[e.noteNumber] = e.isNoteOn ? e.noteId : 0;
+                callback (e);
+            }
+
+            rotate (1);
+            ++played;
+        }
+    }
+
+    // Moves the cursor to `time`, as after a transport jump. Notes that were
+    // sounding are released through callback (event); notes that started before
+    // `time` stay silent until they next come round.
+    template <typename Callback>
+    void seek (int64_t time, Callback&& callback)
+    {
+        releaseSoundingNotes (time, callback);
+        rewind();
+        
+        while (played < count && front().time < time)
+        {
+            const auto e = front();
+            
+            if (droppedNoteIds[e.noteNumber] == e.noteId)
+            {
+                droppedNoteIds[e.noteNumber] = 0;
+                popFront();
+                continue;
+            }
+            
+            rotate (1);
+            ++played;
+        }
+    }
+    
+    // Releases every note playback has started but not yet stopped, through
+    // callback (event), as if their note-offs were all due at `time`.
+    template <typename Callback>
+    void releaseSoundingNotes (int64_t time, Callback&& callback)
+    {
+        flushPendingReleases (time, callback);
+        
+        for (int n = 0; n < 128; ++n)
+        {
+            if (soundingNoteIds[(size_t) n] != 0)
+            {
+                soundingNoteIds[(size_t) n] = 0;
+                callback (LoopEvent { time, 0.0f, 0, (uint8_t) n, false });
+            }
+        }
+    }
+    
+    // Empties the loop but leaves the notes playback has started sounding, handing
+    // their ids over in `sounding` so whatever plays the same events next can
+    // release them. Releases owed by evictions still go out through callback (event).
+    template <typename Callback>
+    void handOverSoundingNotes (int64_t time, Callback&& callback, std::array<uint32_t, 128>& sounding)
+    {
+        flushPendingReleases (time, callback);
+        sounding = soundingNoteIds;
+        clear();
+    }
+    
+    // Recording writes at the current cursor, so callers must have played
+    // everything up to and including `time` first.
+    bool recordNoteOn (int64_t time, int noteNumber, float velocity)
+    {
+        auto& slot = heldNotes[(size_t) noteNumber];
+
+        if (slot.held)
+            return true;
+
+        // Keep room for this note's release and for every other held note's release
+        while (getCapacity() - count < numHeld + 2)
+        {
+            if (policy != OverflowPolicy::dropOldest || count == 0)
+                return policy != OverflowPolicy::stopRecording;
+
+            evictOldest();
+        }
+
+        slot.held = true;
+        slot.noteId = nextNoteId();
+        ++numHeld;
+
+        pushBack ({ time, velocity, slot.noteId, (uint8_t) noteNumber, true });
+        return true;
+    }
+
+    void recordNoteOff (int64_t time, int noteNumber)
+    {
+        auto& slot = heldNotes[(size_t) noteNumber];
+
+        if (! slot.held)
+            return;
+
+        slot.held = false;
+        --numHeld;
+
+        if (slot.noteId != 0)
+            pushBack ({ time, 0.0f, slot.noteId, (uint8_t) noteNumber, false });
+    }
+
+    // Closes any notes still held when recording stops.
+    void releaseHeldNotes (int64_t time)
+    {
+        for (int n = 0; n < 128 && numHeld > 0; ++n)
+            if (heldNotes[(size_t) n].held)
+                recordNoteOff (time, n);
+    }
+
+    // Copies the loop's events out in time order, leaving out notes still being
+    // held and the halves of evicted notes. Only real-time safe if out already
+    // has the capacity for every event.
+    void getEvents (std::vector<LoopEvent>& out) const
+    {
+        out.clear();
+
+        // The played events are the earliest this cycle, so reading from the first
+        // of them gives time order
+        for (int i = 0; i < count; ++i)
+        {
+            const auto& e = at ((count - played + i) % count);
+            const auto& slot = heldNotes[e.noteNumber];
+
+            if (droppedNoteIds[e.noteNumber] == e.noteId)
+                continue;
+
+            if (e.isNoteOn && slot.held && slot.noteId == e.noteId)
+                continue;
+
+            out.push_back (e);
+        }
+    }
+
+    // Replaces the loop with events already in time order and puts the cursor on
+    // the first. Each note-on and its note-off must share a non-zero noteId. Doesn't
+    // allocate, and so is real-time safe, as long as the events fit the capacity.
+    void loadEvents (const LoopEvent* source, int numEvents)
+    {
+        clear();
+
+        if (numEvents > getCapacity())
+            setCapacity (numEvents);
+
+        for (int i = 0; i < numEvents; ++i)
+        {
+            auto& e = events[(size_t) i];
+            e = source[i];
+            e.noteNumber &= 127;
+
+            jassert (e.noteId != 0);
+            lastNoteId = juce::jmax (lastNoteId, e.noteId);
+        }
+
+        count = numEvents;
+    }
+
+    // Not real-time safe. The loop as whole notes, in the order they start.
+    void getNotes (std::vector<RecordedNote>& notes) const
+    {
+        std::vector<LoopEvent> sorted;
+        getEvents (sorted);
+        toNotes (sorted, notes);
+    }
+
+    // Pairs up time-ordered events, as from getEvents(), into whole notes. A note
+    // held across the loop end has an endTick before its startTick.
+    static void toNotes (const std::vector<LoopEvent>& sorted, std::vector<RecordedNote>& notes)
+    {
+        std::unordered_map<uint32_t, int64_t> endTicks;
+        for (const auto& e : sorted)
+            if (! e.isNoteOn)
+                endTicks[e.noteId] = e.time;
+
+        notes.clear();
+
+        for (const auto& e : sorted)
+        {
+            if (! e.isNoteOn)
+                continue;
+
+            const auto end = endTicks.find (e.noteId);
+
+            if (end != endTicks.end())
+                notes.push_back ({ e.noteNumber, e.velocity, e.time, end->second });
+        }
+    }
+
+    // Not real-time safe: replaces the loop with these notes, cursor at the start.
+    void setNotes (const std::vector<RecordedNote>& notes)
+    {
+        std::vector<LoopEvent> sorted;
+        toEvents (notes, sorted);
+        loadEvents (sorted.data(), (int) sorted.size());
+    }
+
+    // The reverse of toNotes(): each note becomes a note-on and note-off with their
+    // own id, in time order
+    static void toEvents (const std::vector<RecordedNote>& notes, std::vector<LoopEvent>& sorted)
+    {
+        // Ties sort releases before note-ons, so a note repeated on the same tick
+        // restarts cleanly, except for a note that ends where it starts
+        struct Keyed { LoopEvent event; int rank; };
+        std::vector<Keyed> keyed;
+        keyed.reserve (notes.size() * 2);
+
+        uint32_t noteId = 0;
+
+        for (const auto& note : notes)
+        {
+            const auto noteNumber = (uint8_t) (note.noteNumber & 127);
+            ++noteId;
+            keyed.push_back ({ { note.startTick, note.velocity, noteId, noteNumber, true }, 1 });
+            keyed.push_back ({ { note.endTick, 0.0f, noteId, noteNumber, false }, note.endTick == note.startTick ? 2 : 0 });
+        }
+
+        std::stable_sort (keyed.begin(), keyed.end(), [] (const Keyed& a, const Keyed& b)
+        {
+            return a.event.time != b.event.time ? a.event.time < b.event.time : a.rank < b.rank;
+        });
+
+        sorted.clear();
+        sorted.reserve (keyed.size());
+        for (const auto& k : keyed)
+            sorted.push_back (k.event);
+    }
+
+private:
+    struct HeldNote
+    {
+        bool held = false;
+        uint32_t noteId = 0;   // 0 once the note-on has been evicted
+    };
+
+    const LoopEvent& at (int index) const   { return events[(size_t) ((head + index) % getCapacity())]; }
+    const LoopEvent& front() const          { return events[(size_t) head]; }
+
+    void popFront()
+    {
+        head = (head + 1) % getCapacity();
+        --count;
+    }
+
+    void pushBack (const LoopEvent& e)
+    {
+        jassert (count < getCapacity());
+        events[(size_t) ((head + count) % getCapacity())] = e;
+        ++count;
+        ++played;
+    }
+
+    // Moves n events from the front to the back. With a full ring the back is
+    // already where the front was, so only the head moves.
+    void rotate (int n)
+    {
+        const auto capacity = getCapacity();
+
+        if (count < capacity)
+            for (int i = 0; i < n; ++i)
+                events[(size_t) ((head + count + i) % capacity)] = events[(size_t) ((head + i) % capacity)];
+
+        head = (head + n) % capacity;
+    }
+
+    // The front is the event that was played or recorded longest ago. Its partner
+    // is dropped when it next comes round, and if playback had started the note
+    // but not yet released it, the release goes out on the next playUntil().
+    void evictOldest()
+    {
+        const auto e = front();
+
+        if (played == count)
+            --played;
+
+        popFront();
+
+        if (e.isNoteOn)
+        {
+            auto& slot = heldNotes[e.noteNumber];
+
+            if (slot.held && slot.noteId == e.noteId)
+                slot.noteId = 0;
+            else
+                droppedNoteIds[e.noteNumber] = e.noteId;
+        }
+        else
+        {
+            droppedNoteIds[e.noteNumber] = e.noteId;
+
+            if (soundingNoteIds[e.noteNumber] == e.noteId && ! pendingReleases[e.noteNumber])
+            {
+                pendingReleases[e.noteNumber] = true;
+                ++numPendingReleases;
+            }
+        }
+    }
+
+    template <typename Callback>
+    void flushPendingReleases (int64_t endTime, Callback& callback)
+    {
+        if (numPendingReleases == 0)
+            return;
+
+        for (int n = 0; n < 128; ++n)
+        {
+            if (pendingReleases[(size_t) n])
+            {
+                soundingNoteIds[(size_t) n] = 0;
+                callback (LoopEvent { endTime - 1, 0.0f, 0, (uint8_t) n, false });
+            }
+        }
+
+        pendingReleases = {};
+        numPendingReleases = 0;
+    }
+
+    uint32_t nextNoteId()
+    {
+        if (++lastNoteId == 0)
+            ++lastNoteId;
+
+        return lastNoteId;
+    }
+
+    std::vector<LoopEvent> events;
+    int head = 0, count = 0, played = 0;
+    OverflowPolicy policy = OverflowPolicy::dropNewest;
+
+    std::array<HeldNote, 128> heldNotes {};
+    int numHeld = 0;
+    uint32_t lastNoteId = 0;
+
+    std::array<uint32_t, 128> droppedNoteIds {};
+    std::array<uint32_t, 128> soundingNoteIds {};
+    std::array<bool, 128> pendingReleases {};
+    int numPendingReleases = 0;
+};
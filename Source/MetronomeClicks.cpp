@@ -0,0 +1,111 @@
+#include "MetronomeClicks.h"
+#include "ReleaseEnvelope.h"
+#include "SineOscillator.h"
+
+void MetronomeClicks::prepare (double sampleRate)
+{
+    reset();
+    preparedSampleRate = sampleRate;
+    
+    for (auto click : { Click::normal, Click::accent })
+    {
+        const auto& source = loaded[(size_t) click];
+        auto& dest = clicks[(size_t) click];
+        
+        if (source.getNumSamples() == 0)
+        {
+            renderBuiltInClick (dest, click == Click::accent ? 84 : 72, sampleRate);
+            continue;
+        }
+        
+        const auto ratio = loadedSampleRate[(size_t) click] / sampleRate;
+        const auto length = juce::jmax (1, (int) std::ceil (source.getNumSamples() / ratio));
+        dest.setSize (1, length);
+        
+        juce::LagrangeInterpolator interpolator;
+        interpolator.process (ratio, source.getReadPointer (0), dest.getWritePointer (0), length, source.getNumSamples(), 0);
+        dest.applyGain (mixLevel);
+    }
+}
+
+// The same sound the metronome's SineWaveVoices used to make: a velocity 0.7
+// sine held for sustainSamples, then the standard release.
+void MetronomeClicks::renderBuiltInClick (juce::AudioBuffer<float>& dest, int noteNumber, double sampleRate)
+{
+    ReleaseEnvelope envelope;
+    envelope.setSampleRate (sampleRate);
+    envelope.startRelease();
+    const auto releaseSamples = envelope.getSamplesToRender (std::numeric_limits<int>::max());
+    
+    dest.setSize (1, sustainSamples + releaseSamples);
+    auto* data = dest.getWritePointer (0);
+    
+    SineOscillator oscillator;
+    oscillator.setFrequency (juce::MidiMessage::getMidiNoteInHertz (noteNumber), sampleRate);
+    oscillator.render (data, dest.getNumSamples());
+    
+    juce::FloatVectorOperations::multiply (data, 0.7f * 0.25f * mixLevel, dest.getNumSamples());
+    envelope.process (data + sustainSamples, releaseSamples);
+}
+
+double MetronomeClicks::getLengthSeconds() const noexcept
+{
+    if (preparedSampleRate <= 0.0)
+        return 0.0;
+    
+    return juce::jmax (clicks[0].getNumSamples(), clicks[1].getNumSamples()) / preparedSampleRate;
+}
+
+bool MetronomeClicks::loadSample (Click click, const juce::File& file)
+{
+    juce::AudioFormatManager formats;
+    formats.registerBasicFormats();
+    
+    std::unique_ptr<juce::AudioFormatReader> reader (formats.createReaderFor (file));
+    
+    if (reader == nullptr || reader->lengthInSamples <= 0 || reader->numChannels == 0)
+        return false;
+    
+    const auto length = (int) juce::jmin (reader->lengthInSamples, (juce::int64) (10.0 * reader->sampleRate));
+    juce::AudioBuffer<float> decoded ((int) reader->numChannels, length);
+    reader->read (&decoded, 0, length, 0, true, true);
+    
+    auto& mono = loaded[(size_t) click];
+    mono.setSize (1, length);
+    mono.clear();
+    
+    for (int ch = 0; ch < decoded.getNumChannels(); ++ch)
+        mono.addFrom (0, 0, decoded, ch, 0, length, 1.0f / (float) decoded.getNumChannels());
+    
+    loadedSampleRate[(size_t) click] = reader->sampleRate;
+    return true;
+}
+
+void MetronomeClicks::trigger (Click click, int offset) noexcept
+{
+    // Clicks are far apart, so running out of slots means the tempo is absurd; keep the newest
+    if (numPlaying == (int) playing.size())
+        playing[0] = playing[(size_t) --numPlaying];
+    
+    playing[(size_t) numPlaying++] = { &clicks[(size_t) click], 0, offset };
+}
+
+void MetronomeClicks::render (juce::AudioBuffer<float>& buffer, int numSamples) noexcept
+{
+    for (int i = 0; i < numPlaying;)
+    {
+        auto& p = playing[(size_t) i];
+        const auto n = juce::jmin (numSamples - p.startOffset, p.sample->getNumSamples() - p.position);
+        
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            buffer.addFrom (ch, p.startOffset, *p.sample, 0, p.position, n);
+        
+        p.position += n;
+        p.startOffset = 0;
+        
+        if (p.position >= p.sample->getNumSamples())
+            p = playing[(size_t) --numPlaying];
+        else
+            ++i;
+    }
+}
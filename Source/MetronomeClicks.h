@@ -0,0 +1,49 @@
+#pragma once
+#include <JuceHeader.h>
+
+// The metronome's accent and normal clicks, rendered once per sample rate and
+// mixed straight into the output from the offset they are triggered at. Blocks
+// with no click sounding cost nothing. Either click can be replaced by a sample
+// loaded from disk.
+class MetronomeClicks
+{
+public:
+    enum class Click { normal, accent };
+
+    static constexpr float mixLevel = 0.3f;
+    static constexpr int sustainSamples = 1000;   // built-in clicks hold this long, then release
+
+    // Not real-time safe: renders the built-in clicks, or resamples loaded ones.
+    void prepare (double sampleRate);
+
+    // Decodes a file (mixed to mono) to use instead of the built-in click from the
+    // next prepare(). Returns false if the file can't be read.
+    bool loadSample (Click click, const juce::File& file);
+    void useBuiltInClick (Click click) { loaded[(size_t) click].setSize (0, 0); }
+
+    void trigger (Click click, int offset) noexcept;
+    void render (juce::AudioBuffer<float>& buffer, int numSamples) noexcept;
+    void reset() noexcept { numPlaying = 0; }
+    bool isSounding() const noexcept { return numPlaying > 0; }
+    
+    // How long the longer click rings for once triggered, as of the last prepare()
+    double getLengthSeconds() const noexcept;
+
+private:
+    void renderBuiltInClick (juce::AudioBuffer<float>& dest, int noteNumber, double sampleRate);
+
+    struct Playing
+    {
+        const juce::AudioBuffer<float>* sample;
+        int position;
+        int startOffset;
+    };
+
+    std::array<juce::AudioBuffer<float>, 2> clicks;
+    std::array<juce::AudioBuffer<float>, 2> loaded;
+    std::array<double, 2> loadedSampleRate {};
+    double preparedSampleRate = 0.0;
+    
+    std::array<Playing, 4> playing {};
+    int numPlaying = 0;
+};
@@ -0,0 +1,156 @@
+#pragma once
+#include <JuceHeader.h>
+
+#ifndef JUCEBOX_ENABLE_INSTRUMENTATION
+ #define JUCEBOX_ENABLE_INSTRUMENTATION JUCE_DEBUG
+#endif
+
+// Per-block timings and counters from processBlock. The audio thread times each
+// stage and pushes one BlockStats per block into a lock-free FIFO; it never
+// waits, and if nobody is reading, blocks are counted as dropped. A single
+// consumer thread (the editor's display callback, or a headless tool) calls collect() to
+// drain them into running totals.
+//
+// Unless JUCEBOX_ENABLE_INSTRUMENTATION is set, which it is by default only in
+// debug builds, every method is an empty inline and the monitor holds no state.
+class PerformanceMonitor
+{
+public:
+    enum Stage { midiCapture, loopPlayback, synthRender, metronomeRender, gain, numStages };
+
+    struct BlockStats
+    {
+        int numSamples = 0;
+        std::array<uint32_t, numStages> stageNanos {};
+        float load = 0.0f;          // time spent / block duration
+        int activeVoices = 0;
+        int midiEvents = 0;
+    };
+
+    struct Totals
+    {
+        juce::int64 blocks = 0, overruns = 0, dropped = 0;
+        std::array<double, numStages> stageNanosSum {};
+        std::array<uint32_t, numStages> stageNanosMax {};
+        float peakLoad = 0.0f;
+        int peakVoices = 0, peakMidiEvents = 0;
+        BlockStats latest;
+    };
+
+   #if JUCEBOX_ENABLE_INSTRUMENTATION
+    static constexpr bool enabled = true;
+
+    void prepare (double newSampleRate) noexcept
+    {
+        sampleRate = newSampleRate;
+        nanosPerTick = 1.0e9 / (double) juce::Time::getHighResolutionTicksPerSecond();
+    }
+
+    // Audio thread
+    void beginBlock (int numSamples) noexcept
+    {
+        current = {};
+        current.numSamples = numSamples;
+        blockStartTicks = lastMarkTicks = juce::Time::getHighResolutionTicks();
+    }
+
+    void endStage (Stage stage) noexcept
+    {
+        const auto now = juce::Time::getHighResolutionTicks();
+        current.stageNanos[(size_t) stage] = (uint32_t) ((double) (now - lastMarkTicks) * nanosPerTick);
+        lastMarkTicks = now;
+    }
+
+    void endBlock (int activeVoices, int midiEvents) noexcept
+    {
+        const auto elapsedNanos = (double) (lastMarkTicks - blockStartTicks) * nanosPerTick;
+        const auto budgetNanos = current.numSamples * 1.0e9 / sampleRate;
+
+        current.load = budgetNanos > 0.0 ? (float) (elapsedNanos / budgetNanos) : 0.0f;
+        current.activeVoices = activeVoices;
+        current.midiEvents = midiEvents;
+
+        const auto scope = fifo.write (1);
+
+        if (scope.blockSize1 > 0)
+            buffer[(size_t) scope.startIndex1] = current;
+        else
+            dropped.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    // Consumer thread
+    void collect() noexcept
+    {
+        const auto scope = fifo.read (fifo.getNumReady());
+        scope.forEach ([this] (int index) { accumulate (buffer[(size_t) index]); });
+        totals.dropped = dropped.load (std::memory_order_relaxed);
+    }
+
+    const Totals& getTotals() const noexcept   { return totals; }
+    void resetTotals() noexcept                { totals = {}; }
+
+    juce::String getReport() const
+    {
+        static const char* const stageNames[] = { "midi capture", "loop playback", "synth render", "metronome", "gain" };
+        const auto blocks = juce::jmax ((juce::int64) 1, totals.blocks);
+
+        juce::String report;
+        report << "blocks " << totals.blocks << ", overruns " << totals.overruns << ", dropped " << totals.dropped
+               << ", peak load " << juce::String (totals.peakLoad * 100.0f, 1) << "%"
+               << ", peak voices " << totals.peakVoices << ", peak MIDI events " << totals.peakMidiEvents << "\n";
+
+        for (int s = 0; s < numStages; ++s)
+            report << "  " << juce::String (stageNames[s]).paddedRight (' ', 14)
+                   << " mean " << juce::String (totals.stageNanosSum[(size_t) s] / (double) blocks / 1000.0, 2) << " us"
+                   << ", max " << juce::String (totals.stageNanosMax[(size_t) s] / 1000.0, 2) << " us\n";
+
+        return report;
+    }
+   #else
+    static constexpr bool enabled = false;
+
+    void prepare (double) noexcept {}
+    void beginBlock (int) noexcept {}
+    void endStage (Stage) noexcept {}
+    void endBlock (int, int) noexcept {}
+    void collect() noexcept {}
+    Totals getTotals() const noexcept   { return {}; }
+    void resetTotals() noexcept {}
+    juce::String getReport() const      { return "instrumentation disabled (build with JUCEBOX_ENABLE_INSTRUMENTATION=1)\n"; }
+   #endif
+
+private:
+   #if JUCEBOX_ENABLE_INSTRUMENTATION
+    void accumulate (const BlockStats& block) noexcept
+    {
+        ++totals.blocks;
+
+        if (block.load > 1.0f)
+            ++totals.overruns;
+
+        for (size_t s = 0; s < (size_t) numStages; ++s)
+        {
+            totals.stageNanosSum[s] += block.stageNanos[s];
+            totals.stageNanosMax[s] = juce::jmax (totals.stageNanosMax[s], block.stageNanos[s]);
+        }
+
+        totals.peakLoad = juce::jmax (totals.peakLoad, block.load);
+        totals.peakVoices = juce::jmax (totals.peakVoices, block.activeVoices);
+        totals.peakMidiEvents = juce::jmax (totals.peakMidiEvents, block.midiEvents);
+        totals.latest = block;
+    }
+
+    static constexpr int capacity = 512;
+
+    double sampleRate = 44100.0;
+    double nanosPerTick = 1.0;
+    juce::int64 blockStartTicks = 0, lastMarkTicks = 0;
+    BlockStats current;
+
+    juce::AbstractFifo fifo { capacity };
+    std::array<BlockStats, capacity> buffer {};
+    std::atomic<juce::int64> dropped { 0 };
+
+    Totals totals;
+   #endif
+};
@@ -5,7 +5,10 @@ JUCEboxAudioProcessorEditor::JUCEboxAudioProcessorEditor (JUCEboxAudioProcessor&
     : AudioProcessorEditor (&p), audioProcessor (p),
       keyboardComponent (p.getKeyboardState(), juce::MidiKeyboardComponent::horizontalKeyboard)
 {
-    setSize (700, 500);
+    setSize (700, 530);
+    
+    // The cached background covers every pixel, so nothing behind the editor needs redrawing
+    setOpaque (true);
     
     // Apply custom look and feel to entire editor
     setLookAndFeel (&customLookAndFeel);
@@ -39,6 +42,12 @@ JUCEboxAudioProcessorEditor::JUCEboxAudioProcessorEditor (JUCEboxAudioProcessor&
     recordButton.onClick = [this] { audioProcessor.toggleRecording(); };
     addAndMakeVisible (recordButton);
     
+    // Overdub Button
+    overdubButton.setButtonText ("Overdub");
+    overdubButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff2d4a3e));
+    overdubButton.onClick = [this] { audioProcessor.overdub(); };
+    addAndMakeVisible (overdubButton);
+    
     // Clear Button
     clearButton.setButtonText ("Clear Loop");
     clearButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff4a2d2d));
@@ -48,14 +57,16 @@ JUCEboxAudioProcessorEditor::JUCEboxAudioProcessorEditor (JUCEboxAudioProcessor&
     // Metronome Button
     metronomeButton.setButtonText ("Metronome: OFF");
     metronomeButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff3d3d4a));
-    metronomeButton.onClick = [this] { 
-        audioProcessor.toggleMetronome();
-        metronomeButton.setButtonText (audioProcessor.isMetronomeOn() ? "Metronome: ON" : "Metronome: OFF");
-        metronomeButton.setColour (juce::TextButton::buttonColourId, 
-            audioProcessor.isMetronomeOn() ? juce::Colour (0xff4a4a2d) : juce::Colour (0xff3d3d4a));
-    };
+    // The parameter is read on the audio thread's next block; the next display refresh shows the result
+    metronomeButton.onClick = [this] { audioProcessor.toggleMetronome(); };
     addAndMakeVisible (metronomeButton);
     
+    // Host Sync Button
+    syncButton.setButtonText ("Sync: Free");
+    syncButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff3d3d4a));
+    syncButton.onClick = [this] { audioProcessor.setHostSync (! transport.hostSync); };
+    addAndMakeVisible (syncButton);
+    
     // Tempo Slider
     tempoLabel.setText ("Tempo", juce::dontSendNotification);
     tempoLabel.setFont (juce::Font ("Inter", 14.0f, juce::Font::bold));
@@ -65,13 +76,101 @@ JUCEboxAudioProcessorEditor::JUCEboxAudioProcessorEditor (JUCEboxAudioProcessor&
     
     tempoSlider.setSliderStyle (juce::Slider::RotaryHorizontalVerticalDrag);
     tempoSlider.setTextBoxStyle (juce::Slider::TextBoxBelow, false, 60, 20);
-    tempoSlider.setRange (60.0, 200.0, 1.0);
-    tempoSlider.setValue (120.0);
     tempoSlider.setColour (juce::Slider::rotarySliderFillColourId, juce::Colours::orange);
     tempoSlider.setColour (juce::Slider::thumbColourId, juce::Colours::white);
-    tempoSlider.onValueChange = [this] { audioProcessor.setTempo (tempoSlider.getValue()); };
     addAndMakeVisible (tempoSlider);
     
+    tempoAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment> (
+        audioProcessor.apvts, "TEMPO", tempoSlider);
+    
+    // MIDI file buttons. Reading and writing happen off the message thread; the
+    // label reports how it went once the processor calls back.
+    importButton.setButtonText ("Import MIDI");
+    importButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff3d3d4a));
+    importButton.onClick = [this] { chooseImportFile(); };
+    addAndMakeVisible (importButton);
+    
+    exportButton.setButtonText ("Export MIDI");
+    exportButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff3d3d4a));
+    exportButton.onClick = [this] { chooseExportFile(); };
+    addAndMakeVisible (exportButton);
+    
+    exportAudioButton.setButtonText ("Export Audio");
+    exportAudioButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff3d3d4a));
+    exportAudioButton.onClick = [this] { showAudioExportMenu(); };
+    addAndMakeVisible (exportAudioButton);
+    
+    fileLabel.setFont (juce::Font ("Inter", 12.0f, juce::Font::plain));
+    fileLabel.setJustificationType (juce::Justification::centredLeft);
+    fileLabel.setColour (juce::Label::textColourId, juce::Colours::grey);
+    addAndMakeVisible (fileLabel);
+    
+    // Layers and undo. The history publishes each change to the audio thread itself.
+    undoButton.setButtonText ("Undo");
+    undoButton.onClick = [this] { audioProcessor.getLoopHistory().undo(); };
+    addAndMakeVisible (undoButton);
+    
+    redoButton.setButtonText ("Redo");
+    redoButton.onClick = [this] { audioProcessor.getLoopHistory().redo(); };
+    addAndMakeVisible (redoButton);
+    
+    layersLabel.setText ("Layers", juce::dontSendNotification);
+    layersLabel.setFont (juce::Font ("Inter", 14.0f, juce::Font::bold));
+    layersLabel.setJustificationType (juce::Justification::centredRight);
+    layersLabel.setColour (juce::Label::textColourId, juce::Colours::white);
+    addAndMakeVisible (layersLabel);
+    
+    layerBox.setTextWhenNoChoicesAvailable ("No layers");
+    layerBox.onChange = [this] { updateLayerControls(); };
+    addAndMakeVisible (layerBox);
+    
+    muteButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff3d3d4a));
+    muteButton.onClick = [this]
+    {
+        const auto index = getSelectedLayer();
+        if (juce::isPositiveAndBelow (index, (int) layers.size()))
+            audioProcessor.getLoopHistory().setLayerMuted (index, ! layers[(size_t) index].muted);
+    };
+    addAndMakeVisible (muteButton);
+    
+    layerVolumeSlider.setSliderStyle (juce::Slider::LinearHorizontal);
+    layerVolumeSlider.setTextBoxStyle (juce::Slider::TextBoxRight, false, 50, 20);
+    layerVolumeSlider.setRange (0.0, 1.0, 0.01);
+    layerVolumeSlider.setColour (juce::Slider::trackColourId, juce::Colours::cyan);
+    layerVolumeSlider.onValueChange = [this]
+    {
+        audioProcessor.getLoopHistory().setLayerVolume (getSelectedLayer(), (float) layerVolumeSlider.getValue());
+    };
+    addAndMakeVisible (layerVolumeSlider);
+    
+    // Voices, for either engine
+    voicesLabel.setText ("Voices", juce::dontSendNotification);
+    voicesLabel.setFont (juce::Font ("Inter", 14.0f, juce::Font::bold));
+    voicesLabel.setJustificationType (juce::Justification::centredRight);
+    voicesLabel.setColour (juce::Label::textColourId, juce::Colours::white);
+    addAndMakeVisible (voicesLabel);
+    
+    polyphonySlider.setSliderStyle (juce::Slider::LinearHorizontal);
+    polyphonySlider.setTextBoxStyle (juce::Slider::TextBoxRight, false, 50, 20);
+    polyphonySlider.setColour (juce::Slider::trackColourId, juce::Colours::orange);
+    addAndMakeVisible (polyphonySlider);
+    
+    polyphonyAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment> (
+        audioProcessor.apvts, "POLYPHONY", polyphonySlider);
+    
+    stealingLabel.setText ("Steal", juce::dontSendNotification);
+    stealingLabel.setFont (juce::Font ("Inter", 14.0f, juce::Font::bold));
+    stealingLabel.setJustificationType (juce::Justification::centredRight);
+    stealingLabel.setColour (juce::Label::textColourId, juce::Colours::white);
+    addAndMakeVisible (stealingLabel);
+    
+    // The items have to be there before the attachment selects one
+    stealingBox.addItemList (audioProcessor.apvts.getParameter ("VOICE_STEALING")->getAllValueStrings(), 1);
+    addAndMakeVisible (stealingBox);
+    
+    stealingAttachment = std::make_unique<juce::AudioProcessorValueTreeState::ComboBoxAttachment> (
+        audioProcessor.apvts, "VOICE_STEALING", stealingBox);
+    
     // Beat indicator label
     beatLabel.setText ("Beat: -", juce::dontSendNotification);
     beatLabel.setFont (juce::Font ("Inter", 18.0f, juce::Font::bold));
@@ -79,82 +178,303 @@ JUCEboxAudioProcessorEditor::JUCEboxAudioProcessorEditor (JUCEboxAudioProcessor&
     beatLabel.setColour (juce::Label::textColourId, juce::Colours::yellow);
     addAndMakeVisible (beatLabel);
     
+    // Audio thread stats, only present in instrumented builds
+    statsLabel.setFont (juce::Font ("Inter", 12.0f, juce::Font::plain));
+    statsLabel.setJustificationType (juce::Justification::centred);
+    statsLabel.setColour (juce::Label::textColourId, juce::Colours::grey);
+    if (PerformanceMonitor::enabled)
+        addAndMakeVisible (statsLabel);
+    
     // Keyboard
     keyboardComponent.setColour (juce::MidiKeyboardComponent::keyDownOverlayColourId, juce::Colours::cyan);
     keyboardComponent.setColour (juce::MidiKeyboardComponent::mouseOverKeyOverlayColourId, juce::Colours::cyan.withAlpha (0.3f));
     addAndMakeVisible (keyboardComponent);
     
-    startTimerHz (30);
+    updateFromProcessor (true);
 }
 
 JUCEboxAudioProcessorEditor::~JUCEboxAudioProcessorEditor() 
 {
-    stopTimer();
     setLookAndFeel (nullptr);
 }
 
-void JUCEboxAudioProcessorEditor::timerCallback()
+void JUCEboxAudioProcessorEditor::chooseImportFile()
+{
+    fileChooser = std::make_unique<juce::FileChooser> ("Import a loop", juce::File(), "*.mid;*.midi");
+    
+    fileChooser->launchAsync (juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                              [this] (const juce::FileChooser& chooser)
+    {
+        const auto file = chooser.getResult();
+        if (file == juce::File()) return;
+        
+        showFileStatus ("Importing " + file.getFileName() + "...");
+        
+        audioProcessor.importLoop (file, [safeThis = juce::Component::SafePointer<JUCEboxAudioProcessorEditor> (this), file] (bool succeeded)
+        {
+            if (safeThis != nullptr)
+                safeThis->showFileStatus ((succeeded ? "Imported " : "No notes read from ") + file.getFileName());
+        });
+    });
+}
+
+void JUCEboxAudioProcessorEditor::chooseExportFile()
+{
+    fileChooser = std::make_unique<juce::FileChooser> ("Export the loop", juce::File(), "*.mid");
+    
+    fileChooser->launchAsync (juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles
+                                | juce::FileBrowserComponent::warnAboutOverwriting,
+                              [this] (const juce::FileChooser& chooser)
+    {
+        auto file = chooser.getResult();
+        if (file == juce::File()) return;
+        
+        if (! file.hasFileExtension ("mid;midi"))
+            file = file.withFileExtension ("mid");
+        
+        showFileStatus ("Exporting " + file.getFileName() + "...");
+        
+        audioProcessor.exportLoop (file, [safeThis = juce::Component::SafePointer<JUCEboxAudioProcessorEditor> (this), file] (bool succeeded)
+        {
+            if (safeThis != nullptr)
+                safeThis->showFileStatus ((succeeded ? "Exported " : "Couldn't write ") + file.getFileName());
+        });
+    });
+}
+
+void JUCEboxAudioProcessorEditor::showAudioExportMenu()
+{
+    // Item ids are the number of times round the loop, plus 100 for stems
+    juce::PopupMenu menu;
+    
+    for (auto numLoops : { 1, 4, 8 })
+        menu.addItem (numLoops, "Mix, " + juce::String (numLoops) + (numLoops == 1 ? " loop" : " loops"));
+    
+    menu.addSeparator();
+    
+    for (auto numLoops : { 1, 4, 8 })
+        menu.addItem (100 + numLoops, "Stems, " + juce::String (numLoops) + (numLoops == 1 ? " loop" : " loops"));
+    
+    menu.showMenuAsync (juce::PopupMenu::Options().withTargetComponent (exportAudioButton),
+                        [safeThis = juce::Component::SafePointer<JUCEboxAudioProcessorEditor> (this)] (int result)
+    {
+        if (safeThis != nullptr && result != 0)
+            safeThis->chooseAudioExportFile (result % 100, result > 100);
+    });
+}
+
+void JUCEboxAudioProcessorEditor::chooseAudioExportFile (int numLoops, bool stems)
+{
+    fileChooser = std::make_unique<juce::FileChooser> (stems ? "Export each layer as audio" : "Export the loop as audio",
+                                                       juce::File(), "*.wav;*.flac");
+    
+    fileChooser->launchAsync (juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles
+                                | juce::FileBrowserComponent::warnAboutOverwriting,
+                              [this, numLoops, stems] (const juce::FileChooser& chooser)
+    {
+        auto file = chooser.getResult();
+        if (file == juce::File()) return;
+        
+        if (! file.hasFileExtension ("wav;flac"))
+            file = file.withFileExtension ("wav");
+        
+        showFileStatus ("Rendering " + file.getFileName() + "...");
+        
+        audioProcessor.exportAudio (file, numLoops, stems,
+                                    [safeThis = juce::Component::SafePointer<JUCEboxAudioProcessorEditor> (this), file] (bool succeeded, int numFiles, double speedUp)
+        {
+            if (safeThis == nullptr)
+                return;
+            
+            if (! succeeded)
+                safeThis->showFileStatus ("Couldn't write " + file.getFileName());
+            else if (numFiles == 0)
+                safeThis->showFileStatus ("No unmuted layers to export");
+            else
+                safeThis->showFileStatus ("Rendered " + juce::String (numFiles) + (numFiles == 1 ? " file" : " files")
+                                          + " at " + juce::String (speedUp, 0) + "x real time");
+        });
+    });
+}
+
+void JUCEboxAudioProcessorEditor::showFileStatus (const juce::String& text)
+{
+    fileLabel.setText (text, juce::dontSendNotification);
+}
+
+void JUCEboxAudioProcessorEditor::updateLayerControls()
+{
+    const auto index = getSelectedLayer();
+    const auto hasLayer = juce::isPositiveAndBelow (index, (int) layers.size());
+    
+    muteButton.setEnabled (hasLayer);
+    layerVolumeSlider.setEnabled (hasLayer);
+    
+    if (hasLayer)
+    {
+        const auto& layer = layers[(size_t) index];
+        muteButton.setButtonText (layer.muted ? "Muted" : "Mute");
+        muteButton.setColour (juce::TextButton::buttonColourId, layer.muted ? juce::Colour (0xff4a2d2d) : juce::Colour (0xff3d3d4a));
+        layerVolumeSlider.setValue (layer.volume, juce::dontSendNotification);
+    }
+    else
+    {
+        muteButton.setButtonText ("Mute");
+    }
+}
+
+int JUCEboxAudioProcessorEditor::getProgressWidth() const
 {
+    return transport.playing ? juce::roundToInt (progressArea.getWidth() * transport.loopPosition) : -1;
+}
+
+void JUCEboxAudioProcessorEditor::updateFromProcessor (bool force)
+{
+    // One consistent read of the audio thread's state per frame; paint() uses it too
+    const auto previous = transport;
+    transport = audioProcessor.getTransportSnapshot();
+    
     // Update record button appearance
-    if (audioProcessor.isRecording())
+    if (force || transport.recording != previous.recording || transport.playing != previous.playing)
     {
-        recordButton.setButtonText ("Recording...");
-        recordButton.setColour (juce::TextButton::buttonColourId, juce::Colours::red);
+        if (transport.recording)
+        {
+            recordButton.setButtonText ("Recording...");
+            recordButton.setColour (juce::TextButton::buttonColourId, juce::Colours::red);
+        }
+        else if (transport.playing)
+        {
+            recordButton.setButtonText ("Playing (click to stop)");
+            recordButton.setColour (juce::TextButton::buttonColourId, juce::Colours::green);
+        }
+        else
+        {
+            recordButton.setButtonText ("Record / Play");
+            recordButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff2d4a3e));
+        }
     }
-    else if (audioProcessor.isPlaying())
+    
+    if (force || transport.metronomeOn != previous.metronomeOn)
     {
-        recordButton.setButtonText ("Playing (click to stop)");
-        recordButton.setColour (juce::TextButton::buttonColourId, juce::Colours::green);
+        metronomeButton.setButtonText (transport.metronomeOn ? "Metronome: ON" : "Metronome: OFF");
+        metronomeButton.setColour (juce::TextButton::buttonColourId, 
+            transport.metronomeOn ? juce::Colour (0xff4a4a2d) : juce::Colour (0xff3d3d4a));
     }
-    else
+    
+    if (force || transport.hostSync != previous.hostSync)
     {
-        recordButton.setButtonText ("Record / Play");
-        recordButton.setColour (juce::TextButton::buttonColourId, juce::Colour (0xff2d4a3e));
+        syncButton.setButtonText (transport.hostSync ? "Sync: Host" : "Sync: Free");
+        syncButton.setColour (juce::TextButton::buttonColourId, 
+            transport.hostSync ? juce::Colour (0xff2d3d4a) : juce::Colour (0xff3d3d4a));
+        
+        // The host sets the tempo while synced
+        tempoSlider.setEnabled (! transport.hostSync);
     }
     
     // Update beat indicator
-    int beat = audioProcessor.getCurrentBeat();
-    if (beat >= 0)
+    if (force || transport.beat != previous.beat)
     {
-        int bar = (beat / 4) + 1;
-        int beatInBar = (beat % 4) + 1;
-        beatLabel.setText ("Bar " + juce::String(bar) + " - Beat " + juce::String(beatInBar), juce::dontSendNotification);
-        
-        if (beatInBar == 1)
-            beatLabel.setColour (juce::Label::textColourId, juce::Colours::orange);
+        if (transport.beat >= 0)
+        {
+            int bar = transport.bar + 1;
+            int beatInBar = transport.beatInBar + 1;
+            beatLabel.setText ("Bar " + juce::String(bar) + " - Beat " + juce::String(beatInBar), juce::dontSendNotification);
+            
+            if (beatInBar == 1)
+                beatLabel.setColour (juce::Label::textColourId, juce::Colours::orange);
+            else
+                beatLabel.setColour (juce::Label::textColourId, juce::Colours::yellow);
+        }
         else
-            beatLabel.setColour (juce::Label::textColourId, juce::Colours::yellow);
+        {
+            beatLabel.setText ("Beat: -", juce::dontSendNotification);
+            beatLabel.setColour (juce::Label::textColourId, juce::Colours::grey);
+        }
     }
-    else
+    
+    auto& history = audioProcessor.getLoopHistory();
+    
+    if (force || history.getRevision() != loopRevision)
+    {
+        loopRevision = history.getRevision();
+        layers = history.getLayers();
+        
+        // Past the limit, the next overdub mixes two of the oldest layers into one
+        layersLabel.setText ("Layers " + juce::String (layers.size()) + "/" + juce::String (LoopVersion::maxLayers),
+                             juce::dontSendNotification);
+        undoButton.setEnabled (history.canUndo());
+        redoButton.setEnabled (history.canRedo());
+        
+        // Keeps the same layer selected, or the newest after an overdub adds one
+        const auto previousCount = layerBox.getNumItems();
+        auto selected = getSelectedLayer();
+        
+        layerBox.clear (juce::dontSendNotification);
+        for (size_t i = 0; i < layers.size(); ++i)
+            layerBox.addItem ("Layer " + juce::String (i + 1) + " (" + juce::String (layers[i].numEvents / 2) + " notes)", (int) i + 1);
+        
+        if ((int) layers.size() > previousCount || ! juce::isPositiveAndBelow (selected, (int) layers.size()))
+            selected = (int) layers.size() - 1;
+        
+        layerBox.setSelectedItemIndex (selected, juce::dontSendNotification);
+        updateLayerControls();
+    }
+    
+    if (PerformanceMonitor::enabled)
     {
-        beatLabel.setText ("Beat: -", juce::dontSendNotification);
-        beatLabel.setColour (juce::Label::textColourId, juce::Colours::grey);
+        auto& monitor = audioProcessor.getPerformanceMonitor();
+        monitor.collect();
+        const auto& totals = monitor.getTotals();
+        auto text = "DSP " + juce::String (totals.latest.load * 100.0f, 1) + "%  |  "
+                    + juce::String (totals.latest.activeVoices) + " voices  |  "
+                    + juce::String (totals.overruns) + " overruns";
+        
+        if (text != statsText)
+        {
+            statsText = text;
+            statsLabel.setText (statsText, juce::dontSendNotification);
+        }
     }
     
-    repaint();
+    // Only the progress strip is redrawn, and only when the bar has moved by a pixel
+    const auto newProgressWidth = getProgressWidth();
+    
+    if (force || newProgressWidth != progressWidth)
+    {
+        progressWidth = newProgressWidth;
+        repaint (progressArea);
+    }
 }
 
 void JUCEboxAudioProcessorEditor::paint (juce::Graphics& g)
 {
-    juce::ColourGradient gradient (juce::Colour (0xff16213e), 0, 0,
-                                    juce::Colour (0xff0f3460), 0, (float) getHeight(), false);
-    g.setGradientFill (gradient);
-    g.fillRect (getLocalBounds());
+    g.drawImageAt (background, 0, 0);
     
     // Draw loop progress bar
-    if (audioProcessor.isPlaying())
+    if (progressWidth >= 0)
     {
         g.setColour (juce::Colour (0xff2a2a4a));
-        g.fillRoundedRectangle (20.0f, 320.0f, getWidth() - 40.0f, 20.0f, 5.0f);
+        g.fillRoundedRectangle (progressArea.toFloat(), 5.0f);
         
         g.setColour (juce::Colours::cyan);
-        float progress = (float) audioProcessor.getLoopPosition();
-        g.fillRoundedRectangle (20.0f, 320.0f, (getWidth() - 40.0f) * progress, 20.0f, 5.0f);
+        g.fillRoundedRectangle (progressArea.withWidth (progressWidth).toFloat(), 5.0f);
     }
 }
 
 void JUCEboxAudioProcessorEditor::resized()
 {
+    background = juce::Image (juce::Image::RGB, juce::jmax (1, getWidth()), juce::jmax (1, getHeight()), false);
+    {
+        juce::Graphics g (background);
+        juce::ColourGradient gradient (juce::Colour (0xff16213e), 0, 0,
+                                        juce::Colour (0xff0f3460), 0, (float) getHeight(), false);
+        g.setGradientFill (gradient);
+        g.fillAll();
+    }
+    
+    progressArea = { 20, 320, getWidth() - 40, 20 };
+    progressWidth = getProgressWidth();
+    
     titleLabel.setBounds (0, 10, getWidth(), 40);
     
     // Left side - Gain
@@ -163,6 +483,7 @@ void JUCEboxAudioProcessorEditor::resized()
     
     // Center - Looper controls
     recordButton.setBounds (180, 80, 120, 40);
+    overdubButton.setBounds (20, 240, 150, 30);
     clearButton.setBounds (180, 130, 120, 40);
     beatLabel.setBounds (180, 180, 120, 30);
     
@@ -170,7 +491,29 @@ void JUCEboxAudioProcessorEditor::resized()
     tempoSlider.setBounds (350, 70, 100, 100);
     tempoLabel.setBounds (350, 170, 100, 25);
     metronomeButton.setBounds (480, 100, 140, 40);
+    statsLabel.setBounds (460, 150, 180, 20);
+    syncButton.setBounds (480, 180, 140, 40);
+    
+    // MIDI files
+    importButton.setBounds (180, 240, 120, 30);
+    exportButton.setBounds (310, 240, 120, 30);
+    exportAudioButton.setBounds (310, 200, 120, 30);
+    fileLabel.setBounds (440, 240, getWidth() - 460, 30);
+    
+    // Layers
+    undoButton.setBounds (20, 205, 72, 28);
+    redoButton.setBounds (98, 205, 72, 28);
+    layersLabel.setBounds (20, 280, 150, 28);
+    layerBox.setBounds (180, 280, 120, 28);
+    muteButton.setBounds (310, 280, 120, 28);
+    layerVolumeSlider.setBounds (440, 280, getWidth() - 460, 28);
+    
+    // Voices, under the progress bar
+    voicesLabel.setBounds (20, 352, 150, 28);
+    polyphonySlider.setBounds (180, 352, 250, 28);
+    stealingLabel.setBounds (440, 352, 60, 28);
+    stealingBox.setBounds (510, 352, getWidth() - 530, 28);
     
     // Keyboard at bottom
-    keyboardComponent.setBounds (10, 360, getWidth() - 20, 120);
+    keyboardComponent.setBounds (10, 395, getWidth() - 20, 120);
 }
@@ -21,8 +21,7 @@ public:
     }
 };
 
-class JUCEboxAudioProcessorEditor : public juce::AudioProcessorEditor,
-                                    private juce::Timer
+class JUCEboxAudioProcessorEditor : public juce::AudioProcessorEditor
 {
 public:
     JUCEboxAudioProcessorEditor (JUCEboxAudioProcessor&);
@@ -30,10 +29,27 @@ public:
 
     void paint (juce::Graphics&) override;
     void resized() override;
-    void timerCallback() override;
 
 private:
+    // Called on every display refresh; only touches widgets whose state changed
+    void updateFromProcessor (bool force);
+    int getProgressWidth() const;
+    void chooseImportFile();
+    void chooseExportFile();
+    void showAudioExportMenu();
+    void chooseAudioExportFile (int numLoops, bool stems);
+    void showFileStatus (const juce::String& text);
+    void updateLayerControls();
+    int getSelectedLayer() const { return layerBox.getSelectedItemIndex(); }
+    
     JUCEboxAudioProcessor& audioProcessor;
+    TransportSnapshot transport;
+    
+    // The gradient only changes with the size, so it's drawn once per resize
+    juce::Image background;
+    juce::Rectangle<int> progressArea;
+    int progressWidth = -1;
+    juce::String statsText;
     
     CustomLookAndFeel customLookAndFeel;
     
@@ -44,13 +60,42 @@ private:
     juce::MidiKeyboardComponent keyboardComponent;
     
     juce::TextButton recordButton;
+    juce::TextButton overdubButton;
     juce::TextButton clearButton;
     juce::TextButton metronomeButton;
+    juce::TextButton syncButton;
     juce::Label tempoLabel;
     juce::Slider tempoSlider;
     juce::Label beatLabel;
+    juce::Label statsLabel;
+    
+    juce::TextButton importButton;
+    juce::TextButton exportButton;
+    juce::TextButton exportAudioButton;
+    juce::Label fileLabel;
+    std::unique_ptr<juce::FileChooser> fileChooser;
+    
+    // Overdub layers, redrawn whenever the loop history changes
+    juce::TextButton undoButton;
+    juce::TextButton redoButton;
+    juce::Label layersLabel;
+    juce::ComboBox layerBox;
+    juce::TextButton muteButton;
+    juce::Slider layerVolumeSlider;
+    std::vector<LoopHistory::LayerInfo> layers;
+    int loopRevision = -1;
+    
+    juce::Label voicesLabel;
+    juce::Slider polyphonySlider;
+    juce::Label stealingLabel;
+    juce::ComboBox stealingBox;
     
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> gainAttachment;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> tempoAttachment;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> polyphonyAttachment;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment> stealingAttachment;
+    
+    juce::VBlankAttachment vblank { this, [this] { updateFromProcessor (false); } };
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (JUCEboxAudioProcessorEditor)
 };
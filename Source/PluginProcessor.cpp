@@ -1,77 +1,273 @@
 #include "PluginProcessor.h"
-#include "PluginEditor.h"
+#include "LoopBouncer.h"
+#if ! JUCEBOX_HEADLESS
+ #include "PluginEditor.h"
+#endif
 
-bool SineWaveVoice::canPlaySound (juce::SynthesiserSound* sound)
+bool SineWaveVoice::canPlaySound (juce::SynthesiserSound*)
 {
-    return dynamic_cast<SineWaveSound*> (sound) != nullptr;
+    // Only SineWaveSounds are ever added, so there's no need to check the type on every note
+    return true;
 }
 
 void SineWaveVoice::startNote (int midiNoteNumber, float velocity, juce::SynthesiserSound*, int)
 {
-    currentAngle = 0.0;
     level = velocity * 0.25;
-    tailOff = 0.0;
+    stolen = false;
+    envelope.reset();
     
-    auto cyclesPerSecond = juce::MidiMessage::getMidiNoteInHertz (midiNoteNumber);
-    auto cyclesPerSample = cyclesPerSecond / getSampleRate();
-    angleDelta = cyclesPerSample * 2.0 * juce::MathConstants<double>::pi;
+    if (! playing && owner != nullptr)
+        owner->voiceStarted (index);
+    playing = true;
+    
+    oscillator.reset();
+    oscillator.setFrequency (juce::MidiMessage::getMidiNoteInHertz (midiNoteNumber), getSampleRate());
 }
 
 void SineWaveVoice::stopNote (float, bool allowTailOff)
 {
     if (allowTailOff)
     {
-        if (tailOff == 0.0)
-            tailOff = 1.0;
+        envelope.startRelease();
     }
     else
     {
-        clearCurrentNote();
-        angleDelta = 0.0;
+        finishNote();
     }
 }
 
+void SineWaveVoice::startFade()
+{
+    if (! stolen && owner != nullptr)
+        owner->voiceStolen();
+    
+    stolen = true;
+    envelope.startFade (VoiceBank::stealFadeMs);
+}
+
+void SineWaveVoice::finishNote()
+{
+    clearCurrentNote();
+    oscillator.stop();
+    
+    if (playing && owner != nullptr)
+        owner->voiceStopped (index, stolen);
+    playing = false;
+}
+
+void SineWaveVoice::setCurrentPlaybackSampleRate (double newRate)
+{
+    juce::SynthesiserVoice::setCurrentPlaybackSampleRate (newRate);
+    
+    if (newRate > 0.0)
+        envelope.setSampleRate (newRate);
+}
+
+int SineWaveVoice::renderToScratch (int numSamples)
+{
+    auto audible = envelope.getSamplesToRender (numSamples);
+    
+    oscillator.render (scratch, audible);
+    juce::FloatVectorOperations::multiply (scratch, (float) level, audible);
+    envelope.process (scratch, audible);
+    
+    if (envelope.isFinished())
+        finishNote();
+    
+    return audible;
+}
+
 void SineWaveVoice::renderNextBlock (juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples)
 {
-    if (angleDelta != 0.0)
+    jassert (scratch != nullptr);
+    
+    while (numSamples > 0 && oscillator.isActive())
+    {
+        auto chunk = juce::jmin (numSamples, scratchSize);
+        auto rendered = renderToScratch (chunk);
+        
+        for (int ch = 0; ch < outputBuffer.getNumChannels(); ++ch)
+            juce::FloatVectorOperations::add (outputBuffer.getWritePointer (ch, startSample), scratch, rendered);
+        
+        startSample += chunk;
+        numSamples -= chunk;
+    }
+}
+
+void StealingSynthesiser::addSineVoices (int numVoices)
+{
+    for (int i = 0; i < numVoices; ++i)
+    {
+        const auto index = getNumVoices();
+        auto* voice = new SineWaveVoice();
+        voice->setOwner (this, index);
+        addVoice (voice);
+        
+        freeVoices.push_back (index);
+        freePosition.push_back (numFree++);
+    }
+}
+
+void StealingSynthesiser::voiceStarted (int index)
+{
+    // Swaps the last free voice into its place
+    const auto position = freePosition[(size_t) index];
+    const auto last = freeVoices[(size_t) --numFree];
+    freeVoices[(size_t) position] = last;
+    freePosition[(size_t) last] = position;
+    
+    ++numActive;
+    ++numSounding;
+}
+
+void StealingSynthesiser::voiceStopped (int index, bool wasStolen)
+{
+    freeVoices[(size_t) numFree] = index;
+    freePosition[(size_t) index] = numFree++;
+    
+    --numActive;
+    if (! wasStolen)
+        --numSounding;
+}
+
+juce::SynthesiserVoice* StealingSynthesiser::findFreeVoice (juce::SynthesiserSound*, int, int, bool) const
+{
+    // Called with the synth's lock held, on the audio thread. A steal lowers numSounding.
+    while (numSounding >= polyphony)
+    {
+        auto* victim = stealPolicy == VoiceBank::StealPolicy::none ? nullptr : findVictim();
+
+        if (victim == nullptr)
+            return nullptr;
+
+        victim->startFade();
+    }
+
+    // If every spare is still fading a stolen voice, startVoice cuts the one nearest its end
+    if (numFree == 0)
+        return findFadingVoice();
+
+    return voices.getUnchecked (freeVoices[(size_t) numFree - 1]);
+}
+
+SineWaveVoice* StealingSynthesiser::findFadingVoice() const
+{
+    SineWaveVoice* best = nullptr;
+
+    for (int i = 0; i < voices.size(); ++i)
+    {
+        auto* sine = getSineVoice (i);
+
+        if (sine->isStolen() && (best == nullptr || sine->getLevel() < best->getLevel()))
+            best = sine;
+    }
+
+    return best;
+}
+
+SineWaveVoice* StealingSynthesiser::findVictim() const
+{
+    // Same choice as VoiceBank: a voice already released before one still held, then by the policy
+    SineWaveVoice* best = nullptr;
+
+    for (int i = 0; i < voices.size(); ++i)
     {
-        while (--numSamples >= 0)
+        auto* sine = getSineVoice (i);
+
+        if (! sine->isVoiceActive() || sine->isStolen())
+            continue;
+
+        auto better = best == nullptr || (sine->isReleasing() && ! best->isReleasing());
+
+        if (! better && sine->isReleasing() == best->isReleasing())
+            better = stealPolicy == VoiceBank::StealPolicy::quietest ? sine->getLevel() < best->getLevel()
+                                                                     : sine->wasStartedBefore (*best);
+
+        if (better)
+            best = sine;
+    }
+
+    return best;
+}
+
+void VoiceBankSynth::prepare (double sampleRate, int maximumBlockSize, int numVoices)
+{
+    bank.prepare (sampleRate, numVoices);
+    mono.setSize (1, juce::jmax (1, maximumBlockSize));
+}
+
+void VoiceBankSynth::handleMidiEvent (const juce::MidiMessage& msg)
+{
+    if (msg.isNoteOn())
+    {
+        // Like juce::Synthesiser, a repeated note releases the voice already playing it
+        bank.noteOff (msg.getNoteNumber());
+        bank.noteOn (msg.getNoteNumber(), juce::MidiMessage::getMidiNoteInHertz (msg.getNoteNumber()),
+                     msg.getFloatVelocity() * 0.25f);
+    }
+    else if (msg.isNoteOff())
+    {
+        bank.noteOff (msg.getNoteNumber());
+    }
+    else if (msg.isAllNotesOff() || msg.isAllSoundOff())
+    {
+        bank.allNotesOff (msg.isAllNotesOff());
+    }
+}
+
+void VoiceBankSynth::renderNextBlock (juce::AudioBuffer<float>& outputBuffer, const juce::MidiBuffer& midi,
+                                      int startSample, int numSamples)
+{
+    // Only reallocates if the host exceeds the block size it gave prepareToPlay
+    mono.setSize (1, numSamples, false, false, true);
+    auto* out = mono.getWritePointer (0);
+    juce::FloatVectorOperations::clear (out, numSamples);
+    
+    int rendered = 0;
+    auto renderUpTo = [&] (int end)
+    {
+        if (end > rendered)
         {
-            auto currentSample = (float) (std::sin (currentAngle) * level);
-            
-            if (tailOff > 0.0)
-            {
-                currentSample *= (float) tailOff;
-                tailOff *= 0.9995;
-                
-                if (tailOff <= 0.005)
-                {
-                    clearCurrentNote();
-                    angleDelta = 0.0;
-                    break;
-                }
-            }
-            
-            for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
-                outputBuffer.addSample (i, startSample, currentSample);
-            
-            currentAngle += angleDelta;
-            ++startSample;
+            bank.render (out + rendered, end - rendered);
+            rendered = end;
         }
+    };
+    
+    for (auto it = midi.findNextSamplePosition (startSample); it != midi.cend(); ++it)
+    {
+        const auto metadata = *it;
+        
+        if (metadata.samplePosition >= startSample + numSamples)
+            break;
+        
+        renderUpTo (metadata.samplePosition - startSample);
+        handleMidiEvent (metadata.getMessage());
     }
+    
+    renderUpTo (numSamples);
+    
+    for (int ch = 0; ch < outputBuffer.getNumChannels(); ++ch)
+        juce::FloatVectorOperations::add (outputBuffer.getWritePointer (ch, startSample), out, numSamples);
 }
 
 JUCEboxAudioProcessor::JUCEboxAudioProcessor()
      : AudioProcessor (BusesProperties().withOutput ("Output", juce::AudioChannelSet::stereo(), true)),
        apvts (*this, nullptr, "Parameters", createParameterLayout())
 {
-    for (auto i = 0; i < 16; ++i)
-        synth.addVoice (new SineWaveVoice());
+    // Enough voices for the highest polyphony, plus spares for stolen voices to fade out on
     synth.addSound (new SineWaveSound());
+    synth.addSineVoices (maxPolyphony + maxPolyphony / 4);
+    
+    gainParameter = apvts.getRawParameterValue ("GAIN");
+    tempoParameter = apvts.getRawParameterValue ("TEMPO");
+    metronomeParameter = apvts.getRawParameterValue ("METRONOME");
+    beatsPerBarParameter = apvts.getRawParameterValue ("BEATS_PER_BAR");
+    numBarsParameter = apvts.getRawParameterValue ("NUM_BARS");
+    polyphonyParameter = apvts.getRawParameterValue ("POLYPHONY");
+    stealingParameter = apvts.getRawParameterValue ("VOICE_STEALING");
     
-    for (auto i = 0; i < 2; ++i)
-        metronomeSynth.addVoice (new SineWaveVoice());
-    metronomeSynth.addSound (new SineWaveSound());
+    readParameters();
+    updateTiming();
 }
 
 JUCEboxAudioProcessor::~JUCEboxAudioProcessor() {}
@@ -82,6 +278,20 @@ juce::AudioProcessorValueTreeState::ParameterLayout JUCEboxAudioProcessor::creat
     params.push_back (std::make_unique<juce::AudioParameterFloat> (
         juce::ParameterID { "GAIN", 1 }, "Gain",
         juce::NormalisableRange<float> (0.0f, 1.0f, 0.01f), 0.5f));
+    params.push_back (std::make_unique<juce::AudioParameterFloat> (
+        juce::ParameterID { "TEMPO", 1 }, "Tempo",
+        juce::NormalisableRange<float> (60.0f, 200.0f, 1.0f), 120.0f));
+    params.push_back (std::make_unique<juce::AudioParameterBool> (
+        juce::ParameterID { "METRONOME", 1 }, "Metronome", false));
+    params.push_back (std::make_unique<juce::AudioParameterInt> (
+        juce::ParameterID { "BEATS_PER_BAR", 1 }, "Beats per Bar", 1, LoopFileWorker::LoopSettings::maxBeatsPerBar, 4));
+    params.push_back (std::make_unique<juce::AudioParameterInt> (
+        juce::ParameterID { "NUM_BARS", 1 }, "Bars", 1, LoopFileWorker::LoopSettings::maxBars, 4));
+    params.push_back (std::make_unique<juce::AudioParameterInt> (
+        juce::ParameterID { "POLYPHONY", 1 }, "Polyphony", 1, maxPolyphony, defaultPolyphony));
+    // In the order of VoiceBank::StealPolicy
+    params.push_back (std::make_unique<juce::AudioParameterChoice> (
+        juce::ParameterID { "VOICE_STEALING", 1 }, "Voice Stealing", juce::StringArray { "Off", "Oldest", "Quietest" }, 1));
     return { params.begin(), params.end() };
 }
 
@@ -89,21 +299,51 @@ const juce::String JUCEboxAudioProcessor::getName() const { return JucePlugin_Na
 bool JUCEboxAudioProcessor::acceptsMidi() const { return true; }
 bool JUCEboxAudioProcessor::producesMidi() const { return false; }
 bool JUCEboxAudioProcessor::isMidiEffect() const { return false; }
-double JUCEboxAudioProcessor::getTailLengthSeconds() const { return 0.0; }
 int JUCEboxAudioProcessor::getNumPrograms() { return 1; }
 int JUCEboxAudioProcessor::getCurrentProgram() { return 0; }
 void JUCEboxAudioProcessor::setCurrentProgram (int) {}
 const juce::String JUCEboxAudioProcessor::getProgramName (int) { return {}; }
 void JUCEboxAudioProcessor::changeProgramName (int, const juce::String&) {}
 
-void JUCEboxAudioProcessor::prepareToPlay (double sr, int)
+double JUCEboxAudioProcessor::getTailLengthSeconds() const
+{
+    // A released note rings for the release time (the same for both engines),
+    // and a click that has started always plays out
+    return juce::jmax (bankSynth.getReleaseTime() / 1000.0, metronomeClicks.getLengthSeconds());
+}
+
+void JUCEboxAudioProcessor::prepareToPlay (double sr, int samplesPerBlock)
 {
     sampleRate = sr;
     synth.setCurrentPlaybackSampleRate (sr);
-    metronomeSynth.setCurrentPlaybackSampleRate (sr);
     
-    double secondsPerBeat = 60.0 / tempo;
-    loopLengthSamples = (int64_t)(secondsPerBeat * beatsPerBar * numBars * sampleRate);
+    smoothedGain.reset (sr, 0.02);
+    smoothedGain.setCurrentAndTargetValue (gainParameter->load());
+    metronomeClicks.prepare (sr);
+    performanceMonitor.prepare (sr);
+    
+    synthEngine = requestedSynthEngine;
+    bankSynth.prepare (sr, samplesPerBlock, maxPolyphony);
+    
+    // A MidiBuffer event is a 4-byte timestamp, a 2-byte size and the message itself
+    const auto midiBytes = (size_t) maxMidiEventsPerBlock * 16;
+    synthMidi.ensureSize (midiBytes);
+    loopMidi.ensureSize (midiBytes);
+    
+    if (loopTimeline.getCapacity() != loopCapacity)
+        loopTimeline.setCapacity (loopCapacity);
+    loopTimeline.setOverflowPolicy (loopOverflowPolicy);
+    
+    const auto scratchSize = juce::jmax (1, samplesPerBlock);
+    voiceScratch.setSize (1, scratchSize);
+    gainRamp.setSize (1, scratchSize);
+    for (int i = 0; i < synth.getNumVoices(); ++i)
+        if (auto* voice = dynamic_cast<SineWaveVoice*> (synth.getVoice (i)))
+            voice->setScratchBuffer (voiceScratch.getWritePointer (0), scratchSize);
+    
+    readParameters();
+    updateTiming();
+    publishTransportSnapshot();
 }
 
 void JUCEboxAudioProcessor::releaseResources() {}
@@ -113,177 +353,830 @@ bool JUCEboxAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts)
     return layouts.getMainOutputChannelSet() == juce::AudioChannelSet::stereo();
 }
 
+void JUCEboxAudioProcessor::toggleRecording()
+{
+    loopHistory.expectTake();
+    pushCommand ({ TransportCommand::Type::toggleRecording });
+}
+
+void JUCEboxAudioProcessor::overdub()
+{
+    loopHistory.expectTake();
+    pushCommand ({ TransportCommand::Type::overdub });
+}
+
+void JUCEboxAudioProcessor::clearLoop()
+{
+    // Goes through the audio thread, so it lands after any take it has already sent
+    loopHistory.expectTake();
+    pushCommand ({ TransportCommand::Type::clearLoop });
+}
+
+void JUCEboxAudioProcessor::setHostSync (bool shouldSync) { pushCommand ({ TransportCommand::Type::setHostSync, shouldSync ? 1.0 : 0.0 }); }
+
+void JUCEboxAudioProcessor::setParameterValue (const juce::String& id, float value)
+{
+    auto* parameter = apvts.getParameter (id);
+    parameter->beginChangeGesture();
+    parameter->setValueNotifyingHost (parameter->convertTo0to1 (value));
+    parameter->endChangeGesture();
+}
+
 void JUCEboxAudioProcessor::setTempo (double bpm)
 {
-    tempo = bpm;
-    double secondsPerBeat = 60.0 / tempo;
-    loopLengthSamples = (int64_t)(secondsPerBeat * beatsPerBar * numBars * sampleRate);
+    // The loop is stored in ticks, so it simply plays faster or slower from the next block
+    setParameterValue ("TEMPO", (float) bpm);
 }
 
-void JUCEboxAudioProcessor::toggleRecording()
+void JUCEboxAudioProcessor::toggleMetronome()
+{
+    auto* parameter = apvts.getParameter ("METRONOME");
+    parameter->beginChangeGesture();
+    parameter->setValueNotifyingHost (parameter->getValue() >= 0.5f ? 0.0f : 1.0f);
+    parameter->endChangeGesture();
+}
+
+void JUCEboxAudioProcessor::pushCommand (TransportCommand command)
+{
+    // 64 slots is far more than anyone can click between two blocks, so a full
+    // queue means the audio thread isn't running
+    if (! transportCommands.push (command))
+        jassertfalse;
+}
+
+void JUCEboxAudioProcessor::handleCommand (const TransportCommand& command)
 {
-    if (!recording && !loopPlaying)
+    switch (command.type)
     {
-        recording = true;
+        case TransportCommand::Type::toggleRecording:
+            handleToggleRecording();
+            break;
+            
+        case TransportCommand::Type::overdub:
+            if (recording || recordingRequested || ! loopPlaying)
+                handleToggleRecording();
+            else
+                startRecording();
+            break;
+            
+        case TransportCommand::Type::clearLoop:
+            recording = recordingRequested = false;
+            loopPlaying = false;
+            loopTimeline.releaseSoundingNotes ((int64_t) std::ceil (loopPositionTicks), [this] (const LoopEvent& e) { releaseLoopNote (e); });
+            loopTimeline.clear();
+            takeAwaitingLayer = 0;
+            loopHistory.submitClear();
+            loopPositionTicks = 0.0;
+            lastMetronomeBeat = -1;
+            break;
+            
+        case TransportCommand::Type::setHostSync:
+            hostSync = command.value != 0.0;
+            hostPlaying = false;
+            lastMetronomeBeat = -1;
+            break;
+    }
+}
+
+void JUCEboxAudioProcessor::handleToggleRecording()
+{
+    if (!recording && !recordingRequested && !loopPlaying)
+    {
+        startRecording();
         loopPlaying = true;
-        loopPositionSamples = 0;
+        loopPositionTicks = 0.0;
+        loopTimeline.rewind();
+        loopLayers.rewind();
         lastMetronomeBeat = -1;
     }
-    else if (recording)
+    else if (recording || recordingRequested)
     {
-        recording = false;
+        recording = recordingRequested = false;
     }
     else
     {
         loopPlaying = !loopPlaying;
         if (loopPlaying)
         {
-            loopPositionSamples = 0;
+            loopPositionTicks = 0.0;
+            loopTimeline.rewind();
+            loopLayers.rewind();
             lastMetronomeBeat = -1;
         }
+        else
+        {
+            // Otherwise the notes it was playing would hang until it started again
+            seekPlayback ((int64_t) std::ceil (loopPositionTicks));
+        }
     }
 }
 
-void JUCEboxAudioProcessor::clearLoop()
+void JUCEboxAudioProcessor::startRecording()
+{
+    // Each pass records into an empty take, so one still waiting to become a
+    // layer holds the next back, usually for no more than a block or two
+    if (takeAwaitingLayer != 0)
+        recordingRequested = true;
+    else
+        recording = true;
+}
+
+void JUCEboxAudioProcessor::readParameters()
+{
+    smoothedGain.setTargetValue (gainParameter->load());
+    metronomeOn = metronomeParameter->load() >= 0.5f;
+    numBars = juce::roundToInt (numBarsParameter->load());
+    
+    // Both engines only move a limit, so this is cheap enough to do every block
+    const auto voices = juce::roundToInt (polyphonyParameter->load());
+    const auto stealing = (VoiceBank::StealPolicy) juce::roundToInt (stealingParameter->load());
+    bankSynth.setPolyphony (voices, stealing);
+    synth.setPolyphony (voices, stealing);
+    
+    // In sync mode followHostTransport() takes these from the host instead
+    if (! hostSync)
+    {
+        tempo = tempoParameter->load();
+        beatsPerBar = juce::roundToInt (beatsPerBarParameter->load());
+        beatUnit = 4;
+    }
+}
+
+void JUCEboxAudioProcessor::updateTiming()
+{
+    const TimingKey key { sampleRate, tempo, beatsPerBar, beatUnit, numBars };
+    
+    if (key == timingKey)
+        return;
+    
+    timingKey = key;
+    samplesPerTick = BlockTicks::getSamplesPerTick (sampleRate, tempo);
+    
+    const auto newLength = (int64_t) beatsPerBar * numBars * getTicksPerBeat();
+    
+    if (newLength != loopLengthTicks)
+    {
+        loopLengthTicks = newLength;
+        
+        // A shorter loop cuts off whatever was recorded past its new end
+        if (loopPositionTicks >= (double) loopLengthTicks)
+            seekLoop (std::fmod (loopPositionTicks, (double) loopLengthTicks));
+    }
+}
+
+void JUCEboxAudioProcessor::releaseLoopNote (const LoopEvent& e)
+{
+    // Notes left sounding by a stop or a jump are released at the start of the block
+    loopMidi.addEvent (juce::MidiMessage::noteOff (1, e.noteNumber), 0);
+}
+
+void JUCEboxAudioProcessor::addLoopEvent (const LoopEvent& e, float gain)
 {
-    recording = false;
-    loopPlaying = false;
-    recordedNotes.clear();
-    activeNoteStarts.clear();
-    loopPositionSamples = 0;
+    auto offset = blockTicks.getSampleOffset ((double) e.time);
+    
+    if (e.isNoteOn)
+        loopMidi.addEvent (juce::MidiMessage::noteOn (1, e.noteNumber, e.velocity * gain), offset);
+    else
+        loopMidi.addEvent (juce::MidiMessage::noteOff (1, e.noteNumber), offset);
+}
+
+void JUCEboxAudioProcessor::seekLoop (double tick)
+{
+    if (recording)
+        loopTimeline.releaseHeldNotes ((int64_t) std::ceil (loopPositionTicks));
+    
+    seekPlayback ((int64_t) std::ceil (tick));
+    loopPositionTicks = tick;
     lastMetronomeBeat = -1;
 }
 
-void JUCEboxAudioProcessor::toggleMetronome()
+void JUCEboxAudioProcessor::seekPlayback (int64_t tick)
 {
-    metronomeOn = !metronomeOn;
+    loopLayers.seek (tick, [this] (const LoopEvent& e, float) { releaseLoopNote (e); });
+    loopTimeline.seek (tick, [this] (const LoopEvent& e) { releaseLoopNote (e); });
 }
 
-double JUCEboxAudioProcessor::getLoopPosition() const
+void JUCEboxAudioProcessor::takeLoopVersion()
 {
-    if (loopLengthSamples == 0) return 0.0;
-    return (double)loopPositionSamples / (double)loopLengthSamples;
+    auto* version = loopHistory.takeNewVersion();
+    
+    if (version == nullptr)
+        return;
+    
+    const auto time = (int64_t) std::ceil (loopPositionTicks);
+    loopLayers.setVersion (version, time, [this] (const LoopEvent& e, float) { releaseLoopNote (e); });
+    
+    if (takeAwaitingLayer == 0 || version->takeSerial < takeAwaitingLayer)
+        return;
+    
+    // The take plays on as its layer, which picks up where the take had got to and
+    // releases the notes the take started. If it's been undone already, those stop now.
+    std::array<uint32_t, 128> sounding;
+    loopTimeline.handOverSoundingNotes (time, [this] (const LoopEvent& e) { releaseLoopNote (e); }, sounding);
+    
+    if (! loopLayers.adoptSoundingNotes (version->takeLayer, sounding))
+        for (int n = 0; n < 128; ++n)
+            if (sounding[(size_t) n] != 0)
+                releaseLoopNote ({ time, 0.0f, 0, (uint8_t) n, false });
+    
+    takeAwaitingLayer = 0;
+    
+    if (recordingRequested)
+    {
+        recordingRequested = false;
+        recording = true;
+    }
 }
 
-int JUCEboxAudioProcessor::getCurrentBeat() const
+void JUCEboxAudioProcessor::submitTake()
 {
-    if (!loopPlaying) return -1;
-    double secondsPerBeat = 60.0 / tempo;
-    int64_t samplesPerBeat = (int64_t)(secondsPerBeat * sampleRate);
-    if (samplesPerBeat == 0) return 0;
-    return (int)(loopPositionSamples / samplesPerBeat) % (beatsPerBar * numBars);
+    // Tried every block until there's a buffer free for it
+    if (! recording && takeAwaitingLayer == 0 && ! loopTimeline.isEmpty())
+        takeAwaitingLayer = loopHistory.submitTake (loopTimeline);
+    
+    const auto active = recording || recordingRequested || ! loopTimeline.isEmpty();
+    
+    if (active != takeActive)
+    {
+        takeActive = active;
+        loopHistory.setTakeActive (active);
+    }
 }
 
-void JUCEboxAudioProcessor::processMetronome (juce::MidiBuffer& midiMessages, int numSamples)
+void JUCEboxAudioProcessor::copyTake (TakeCopy& copy)
 {
-    if (!metronomeOn || !loopPlaying) return;
+    // Doesn't allocate: a take that has outgrown the buffer is only measured
+    copy.numEvents = loopTimeline.getNumEvents();
     
-    double secondsPerBeat = 60.0 / tempo;
-    int64_t samplesPerBeat = (int64_t)(secondsPerBeat * sampleRate);
+    if (copy.numEvents <= (int) copy.events.capacity())
+        loopTimeline.getEvents (copy.events);
     
-    for (int i = 0; i < numSamples; ++i)
+    const auto* playing = loopLayers.getVersion();
+    copy.playingSerial = playing != nullptr ? playing->serial : 0;
+    copy.takeAwaitingLayer = takeAwaitingLayer;
+}
+
+void JUCEboxAudioProcessor::serveTakeCopy()
+{
+    if (auto* copy = takeCopyRequest.exchange (nullptr))
+    {
+        copyTake (*copy);
+        copy->done.store (true);
+    }
+}
+
+template <typename Fn>
+std::vector<LoopVersion::Entry> JUCEboxAudioProcessor::copyLoopLayers (Fn&& whileLocked)
+{
+    std::shared_ptr<const LoopVersion> version;
+    TakeCopy take;
+    take.events.reserve (256);
+    
+    for (;;)
     {
-        int64_t currentSample = loopPositionSamples + i;
-        int64_t currentBeat = currentSample / samplesPerBeat;
+        // Read without the history's lock, which its thread can hold for a while, so
+        // the audio thread is never left waiting behind it through the callback lock
+        version = loopHistory.getLatestVersion();
+        
+        take.done.store (false);
+        takeCopyRequest.store (&take);
+        
+        // A block or two at most, unless the host has stopped calling processBlock
+        for (int waited = 0; ! take.done.load() && waited < 100; ++waited)
+            juce::Thread::sleep (1);
         
-        if (currentBeat != lastMetronomeBeat)
         {
-            lastMetronomeBeat = currentBeat;
-            int beatInBar = (int)(currentBeat % beatsPerBar);
-            int noteNumber = (beatInBar == 0) ? 84 : 72;
+            // The lock ends any block that took the request; one that hasn't means no blocks
+            // are coming, and the take can be copied here without holding anything up
+            const juce::ScopedLock lock (getCallbackLock());
+            
+            auto* request = &take;
+            if (takeCopyRequest.compare_exchange_strong (request, nullptr))
+                copyTake (take);
             
-            midiMessages.addEvent (juce::MidiMessage::noteOn (10, noteNumber, 0.7f), i);
-            midiMessages.addEvent (juce::MidiMessage::noteOff (10, noteNumber), i + 1000);
+            whileLocked();
+        }
+        
+        if (take.numEvents > (int) take.events.capacity())
+        {
+            take.events.reserve ((size_t) (take.numEvents + take.numEvents / 4));
+            continue;
+        }
+        
+        // If a newer version had reached the audio thread, the take may have become
+        // a layer of it and left the ring, so look again
+        if (take.playingSerial <= version->serial)
+            break;
+    }
+    
+    // A take still being recorded, or not yet a layer, is saved as one
+    auto layers = version->layers;
+    const auto takeIsLayer = take.takeAwaitingLayer != 0 && version->takeSerial >= take.takeAwaitingLayer;
+    
+    if (! take.events.empty() && ! takeIsLayer)
+        layers.push_back ({ std::make_shared<LoopLayer> (LoopLayer { std::move (take.events) }) });
+    
+    return layers;
+}
+
+void JUCEboxAudioProcessor::exportLoop (const juce::File& file, LoopFileWorker::ExportCallback onDone)
+{
+    LoopFileWorker::LoopSettings settings;
+    
+    LoopVersion loop;
+    loop.layers = copyLoopLayers ([&] { settings = { tempo, beatsPerBar, beatUnit, numBars }; });
+    
+    // What plays: muted layers are left out and the others' volumes baked in
+    std::vector<LoopEvent> events;
+    loop.flatten (events);
+    
+    loopFileWorker.exportLoop (file, std::move (events), settings, std::move (onDone));
+}
+
+void JUCEboxAudioProcessor::importLoop (const juce::File& file, std::function<void (bool)> onDone)
+{
+    juce::WeakReference<JUCEboxAudioProcessor> weakThis (this);
+    
+    loopFileWorker.importLoop (file, [weakThis, onDone] (bool succeeded, const LoopFileWorker::LoopSettings& settings, std::vector<LoopEvent>& events)
+    {
+        if (auto* processor = weakThis.get())
+        {
+            // The file replaces every layer, as one step that can be undone
+            if (succeeded)
+            {
+                processor->loopHistory.replace ({ LoopVersion::Entry { std::make_shared<LoopLayer> (LoopLayer { std::move (events) }) } });
+                processor->setParameterValue ("TEMPO", (float) settings.bpm);
+                processor->setParameterValue ("BEATS_PER_BAR", (float) settings.beatsPerBar);
+                processor->setParameterValue ("NUM_BARS", (float) settings.numBars);
+            }
+            
+            if (onDone != nullptr)
+                onDone (succeeded);
+        }
+    });
+}
+
+void JUCEboxAudioProcessor::exportAudio (const juce::File& file, int numLoops, bool stems, AudioExportCallback onDone)
+{
+    auto state = createSessionState();
+    std::vector<LoopBouncer::Job> jobs;
+    
+    auto addJob = [&] (std::vector<SessionState::Layer> layers, const juce::File& target)
+    {
+        LoopBouncer::Job job;
+        job.state.parameters = state.parameters;
+        job.state.layers = std::move (layers);
+        job.file = target;
+        job.numLoops = juce::jmax (1, numLoops);
+        job.sampleRate = getSampleRate() > 0.0 ? getSampleRate() : 48000.0;
+        job.engine = synthEngine;
+        jobs.push_back (std::move (job));
+    };
+    
+    if (! stems)
+    {
+        addJob (std::move (state.layers), file);
+    }
+    else
+    {
+        for (size_t i = 0; i < state.layers.size(); ++i)
+            if (! state.layers[i].muted)
+                addJob ({ state.layers[i] }, file.getSiblingFile (file.getFileNameWithoutExtension() + " layer "
+                                                                   + juce::String (i + 1) + file.getFileExtension()));
+    }
+    
+    if (loopBouncer == nullptr)
+        loopBouncer = std::make_unique<LoopBouncer>();
+    
+    juce::WeakReference<JUCEboxAudioProcessor> weakThis (this);
+    
+    loopBouncer->bounce (std::move (jobs), [weakThis, onDone] (const LoopBouncer::Report& report)
+    {
+        const auto succeeded = report.succeeded();
+        const auto numFiles = (int) report.results.size();
+        const auto speedUp = report.getSpeedUp();
+        
+        juce::MessageManager::callAsync ([weakThis, onDone, succeeded, numFiles, speedUp]
+        {
+            if (weakThis != nullptr && onDone != nullptr)
+                onDone (succeeded, numFiles, speedUp);
+        });
+    });
+}
+
+void JUCEboxAudioProcessor::applyGain (juce::AudioBuffer<float>& buffer)
+{
+    const auto numSamples = buffer.getNumSamples();
+    
+    if (! smoothedGain.isSmoothing())
+    {
+        buffer.applyGain (smoothedGain.getTargetValue());
+        return;
+    }
+    
+    // The ramp is worked out once, then every channel is multiplied by it in bulk.
+    // Only reallocates if the host exceeds the block size it gave prepareToPlay.
+    gainRamp.setSize (1, numSamples, false, false, true);
+    auto* ramp = gainRamp.getWritePointer (0);
+    
+    for (int i = 0; i < numSamples; ++i)
+        ramp[i] = smoothedGain.getNextValue();
+    
+    for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+        juce::FloatVectorOperations::multiply (buffer.getWritePointer (ch), ramp, numSamples);
+}
+
+void JUCEboxAudioProcessor::setLoopCapacity (int maxEvents, LoopTimeline::OverflowPolicy policy)
+{
+    // Takes effect on the next prepareToPlay, where the ring can be reallocated safely
+    loopCapacity = juce::jmax (2, maxEvents);
+    loopOverflowPolicy = policy;
+    loopHistory.setTakeCapacity (loopCapacity);
+}
+
+void JUCEboxAudioProcessor::setPolyphony (int numVoices, VoiceBank::StealPolicy stealing)
+{
+    // Both engines have voices for maxPolyphony already, so this only moves the limit
+    setParameterValue ("POLYPHONY", (float) numVoices);
+    setParameterValue ("VOICE_STEALING", (float) stealing);
+}
+
+int JUCEboxAudioProcessor::getNumActiveVoices() const
+{
+    if (synthEngine == SynthEngine::voiceBank)
+        return bankSynth.getNumActiveVoices();
+    
+    return synth.getNumActiveVoices();
+}
+
+bool JUCEboxAudioProcessor::isAnyVoiceRendering() const
+{
+    // Not getNumActiveVoices(), which leaves out the voice bank's stolen voices while they fade
+    if (synthEngine == SynthEngine::voiceBank)
+        return bankSynth.getNumActiveSlots() > 0;
+    
+    return synth.getNumActiveVoices() > 0;
+}
+
+void JUCEboxAudioProcessor::publishTransportSnapshot()
+{
+    TransportSnapshot snapshot;
+    snapshot.tempo = tempo;
+    snapshot.recording = recording;
+    snapshot.playing = loopPlaying;
+    snapshot.metronomeOn = metronomeOn;
+    snapshot.hostSync = hostSync;
+    snapshot.activeVoices = getNumActiveVoices();
+    
+    snapshot.loopPosition = loopPositionTicks / (double) getLoopLengthTicks();
+    
+    if (isClockRunning())
+    {
+        snapshot.beat = (int)(loopPositionTicks / (double) getTicksPerBeat()) % (beatsPerBar * numBars);
+        snapshot.bar = snapshot.beat / beatsPerBar;
+        snapshot.beatInBar = snapshot.beat % beatsPerBar;
+    }
+    
+    transportSnapshot.store (snapshot);
+}
+
+void JUCEboxAudioProcessor::processMetronome()
+{
+    const auto ticksPerBeat = getTicksPerBeat();
+    
+    if (metronomeOn && isClockRunning())
+    {
+        // Visit only the beats that start in this block, plus the one in progress
+        // if it hasn't clicked yet (the metronome was just switched on, or the loop wrapped)
+        auto beat = (int64_t) (blockTicks.startTick / (double) ticksPerBeat);
+        if (beat == lastMetronomeBeat)
+            ++beat;
+        
+        // The downbeat at the loop end belongs to the next run, which starts the next cycle
+        const auto endTick = juce::jmin (blockTicks.getEndTick(), (double) getLoopLengthTicks());
+        
+        for (; (double) (beat * ticksPerBeat) < endTick; ++beat)
+        {
+            lastMetronomeBeat = beat;
+            auto offset = blockTicks.getSampleOffset ((double) (beat * ticksPerBeat));
+            auto click = (beat % beatsPerBar == 0) ? MetronomeClicks::Click::accent : MetronomeClicks::Click::normal;
+            metronomeClicks.trigger (click, offset);
         }
     }
 }
 
-void JUCEboxAudioProcessor::processLoopPlayback (juce::MidiBuffer& midiMessages, int numSamples)
+void JUCEboxAudioProcessor::followHostTransport()
 {
-    if (!loopPlaying || recordedNotes.empty()) return;
+    auto* playHead = getPlayHead();
+    if (playHead == nullptr) return;
+    
+    const auto position = playHead->getPosition();
+    if (! position.hasValue()) return;
     
-    int64_t blockStart = loopPositionSamples;
-    int64_t blockEnd = loopPositionSamples + numSamples;
+    if (auto bpm = position->getBpm())
+        if (*bpm > 0.0)
+            tempo = *bpm;
     
-    for (const auto& note : recordedNotes)
+    if (auto signature = position->getTimeSignature())
     {
-        if (note.startSample >= blockStart && note.startSample < blockEnd)
+        if (signature->numerator > 0 && juce::isPowerOfTwo (signature->denominator) && signature->denominator <= 32)
         {
-            int offset = (int)(note.startSample - blockStart);
-            midiMessages.addEvent (juce::MidiMessage::noteOn (1, note.noteNumber, note.velocity), offset);
+            beatsPerBar = signature->numerator;
+            beatUnit = signature->denominator;
         }
+    }
+    
+    updateTiming();
+    
+    const auto wasHostPlaying = hostPlaying;
+    hostPlaying = position->getIsPlaying();
+    
+    if (! hostPlaying)
+    {
+        if (wasHostPlaying)
+            seekPlayback ((int64_t) std::ceil (loopPositionTicks));
+        return;
+    }
+    
+    auto ppq = position->getPpqPosition();
+    if (! ppq.hasValue()) return;
+    
+    // The loop is aligned to the host's bar grid from the start of the song
+    const auto loopLength = (double) getLoopLengthTicks();
+    auto hostTick = std::fmod (*ppq * ticksPerQuarterNote, loopLength);
+    if (hostTick < 0.0)
+        hostTick += loopLength;
+    
+    // Between blocks the position advances by itself, at the tempo the host gave.
+    // Taking the host's position every block stops rounding from accumulating,
+    // and only a real jump (a locate, a cycle, a restart) costs a seek. The distance
+    // is measured around the loop, since at a wrap our position can be just short
+    // of the end while the host's is already back at 0.
+    auto drift = std::abs (hostTick - loopPositionTicks);
+    drift = juce::jmin (drift, loopLength - drift);
+    
+    if (! wasHostPlaying || drift > 1.0)
+    {
+        seekLoop (hostTick);
+    }
+    else if (hostTick < loopPositionTicks - loopLength / 2)
+    {
+        // The host has wrapped and rounding left us a hair short: finish the cycle as processBlock would
+        loopTimeline.rewind();
+        loopLayers.rewind();
+        lastMetronomeBeat = -1;
+        loopPositionTicks = hostTick;
+    }
+    else if (hostTick < loopPositionTicks + loopLength / 2)
+    {
+        loopPositionTicks = hostTick;
+    }
+    // Otherwise we have wrapped and the host hasn't quite; it is less than a tick behind
+}
+
+void JUCEboxAudioProcessor::processLoopPlayback (int64_t endTick)
+{
+    if (!isLoopRunning()) return;
+    
+    loopLayers.playUntil (endTick, [this] (const LoopEvent& e, float gain) { addLoopEvent (e, gain); });
+    loopTimeline.playUntil (endTick, [this] (const LoopEvent& e) { addLoopEvent (e, 1.0f); });
+}
+
+void JUCEboxAudioProcessor::captureRecording()
+{
+    if (wasRecording && !recording)
+        loopTimeline.releaseHeldNotes ((int64_t) blockTicks.startTick);
+    
+    wasRecording = recording;
+    
+    if (!recording) return;
+    
+    // In sync mode the loop stands still while the host is stopped, and anything
+    // recorded then would all land on one tick. Held notes end where it stopped.
+    if (!isClockRunning())
+    {
+        loopTimeline.releaseHeldNotes ((int64_t) blockTicks.startTick);
+        return;
+    }
+    
+    // Each run stops at the loop end, so this only catches rounding on its last sample
+    auto lastTick = getLoopLengthTicks() - 1;
+    
+    for (auto it = synthMidi.findNextSamplePosition (blockTicks.startSample); it != synthMidi.cend(); ++it)
+    {
+        const auto metadata = *it;
+        
+        if (metadata.samplePosition >= blockTicks.getEndSample())
+            break;
+        
+        auto msg = metadata.getMessage();
+        auto time = juce::jmin ((int64_t) blockTicks.getTickAt (metadata.samplePosition), lastTick);
         
-        if (note.endSample >= blockStart && note.endSample < blockEnd)
+        // Play everything up to this point first so the new event lands at the cursor
+        processLoopPlayback (time + 1);
+        
+        if (msg.isNoteOn())
+        {
+            if (!loopTimeline.recordNoteOn (time, msg.getNoteNumber(), 0.8f))
+            {
+                recording = wasRecording = false;
+                loopTimeline.releaseHeldNotes (time);
+                break;
+            }
+        }
+        else if (msg.isNoteOff())
         {
-            int offset = (int)(note.endSample - blockStart);
-            midiMessages.addEvent (juce::MidiMessage::noteOff (1, note.noteNumber), offset);
+            loopTimeline.recordNoteOff (time, msg.getNoteNumber());
         }
     }
 }
 
+void JUCEboxAudioProcessor::processSegment()
+{
+    captureRecording();
+    processLoopPlayback (juce::jmin (blockTicks.getEndTickCeiling(), getLoopLengthTicks()));
+    processMetronome();
+}
+
 void JUCEboxAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    const ScopedRealtimeAllocationGuard allocationGuard;
+    const ScopedMidiCapacityCheck midiCapacityCheck { &synthMidi, &loopMidi };
+    const juce::ScopedNoDenormals noDenormals;
+    
+    const auto numSamples = buffer.getNumSamples();
+    performanceMonitor.beginBlock (numSamples);
+    
+    // Cleared first, since both of these can release notes into it
+    loopMidi.clear();
+    transportCommands.drain ([this] (const TransportCommand& command) { handleCommand (command); });
+    takeLoopVersion();
+    serveTakeCopy();
+    
+    readParameters();
+    if (hostSync)
+        followHostTransport();
+    updateTiming();
+    
     buffer.clear();
     
-    keyboardState.processNextMidiBuffer (midiMessages, 0, buffer.getNumSamples(), true);
+    synthMidi.clear();
+    synthMidi.addEvents (midiMessages, 0, numSamples, 0);
+    keyboardState.processNextMidiBuffer (synthMidi, 0, numSamples, true);
+    performanceMonitor.endStage (PerformanceMonitor::midiCapture);
     
-    if (recording)
+    // This block's tick to sample mapping, at whatever tempo the commands or the host left.
+    // Each cycle of the loop the block covers is handled as its own run, so events and
+    // beats just after a wrap land on their own samples instead of waiting a block.
+    BlockTicks remaining { loopPositionTicks, samplesPerTick, numSamples, 0 };
+    
+    while (remaining.numSamples > 0)
     {
-        for (const auto metadata : midiMessages)
+        blockTicks = remaining;
+        
+        const auto loopLength = (double) getLoopLengthTicks();
+        const auto wraps = isClockRunning() && blockTicks.getEndTick() >= loopLength;
+        
+        if (wraps)
+            remaining = blockTicks.splitAt (loopLength);
+        else
+            remaining.numSamples = 0;
+        
+        processSegment();
+        
+        if (isClockRunning())
         {
-            auto msg = metadata.getMessage();
-            int samplePos = metadata.samplePosition;
-            int64_t absoluteSample = (loopPositionSamples + samplePos) % loopLengthSamples;
+            // The next run starts wherever this one's last sample left off, so the
+            // overshoot carries into the next cycle and the loop doesn't drift
+            loopPositionTicks = wraps ? remaining.startTick : blockTicks.getEndTick();
             
-            if (msg.isNoteOn())
-            {
-                activeNoteStarts[msg.getNoteNumber()] = absoluteSample;
-            }
-            else if (msg.isNoteOff())
+            if (wraps)
             {
-                auto it = activeNoteStarts.find (msg.getNoteNumber());
-                if (it != activeNoteStarts.end())
-                {
-                    RecordedNote note;
-                    note.noteNumber = msg.getNoteNumber();
-                    note.velocity = 0.8f;
-                    note.startSample = it->second;
-                    note.endSample = absoluteSample;
-                    recordedNotes.push_back (note);
-                    activeNoteStarts.erase (it);
-                }
+                loopTimeline.rewind();
+                loopLayers.rewind();
+                lastMetronomeBeat = -1;
             }
         }
     }
     
-    processLoopPlayback (midiMessages, buffer.getNumSamples());
+    submitTake();
     
-    juce::MidiBuffer metronomeMidi;
-    processMetronome (metronomeMidi, buffer.getNumSamples());
+    synthMidi.addEvents (loopMidi, 0, numSamples, 0);
+    performanceMonitor.endStage (PerformanceMonitor::loopPlayback);
     
-    synth.renderNextBlock (buffer, midiMessages, 0, buffer.getNumSamples());
+    // With no voice sounding, no note about to start and no click ringing, the
+    // cleared buffer is already the output, so an idle instance renders nothing
+    const auto silent = synthMidi.isEmpty() && ! isAnyVoiceRendering() && ! metronomeClicks.isSounding();
+    
+    if (silent)
+    {
+        smoothedGain.skip (numSamples);
+    }
+    else
+    {
+        if (synthEngine == SynthEngine::voiceBank)
+            bankSynth.renderNextBlock (buffer, synthMidi, 0, numSamples);
+        else
+            synth.renderNextBlock (buffer, synthMidi, 0, numSamples);
+        performanceMonitor.endStage (PerformanceMonitor::synthRender);
+        
+        // Clicks carry on into later blocks by themselves, even after the metronome is switched off
+        metronomeClicks.render (buffer, numSamples);
+        performanceMonitor.endStage (PerformanceMonitor::metronomeRender);
+        
+        applyGain (buffer);
+    }
     
-    juce::AudioBuffer<float> metronomeBuffer (buffer.getNumChannels(), buffer.getNumSamples());
-    metronomeBuffer.clear();
-    metronomeSynth.renderNextBlock (metronomeBuffer, metronomeMidi, 0, buffer.getNumSamples());
+    performanceMonitor.endStage (PerformanceMonitor::gain);
     
-    for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
-        buffer.addFrom (ch, 0, metronomeBuffer, ch, 0, buffer.getNumSamples(), 0.3f);
+    publishTransportSnapshot();
     
-    if (loopPlaying)
+   #if JUCEBOX_ENABLE_INSTRUMENTATION
+    // Guarded rather than left to the empty inline, since the arguments aren't free to evaluate
+    performanceMonitor.endBlock (getNumActiveVoices(), synthMidi.getNumEvents());
+   #endif
+}
+
+bool JUCEboxAudioProcessor::hasEditor() const { return ! JUCEBOX_HEADLESS; }
+
+juce::AudioProcessorEditor* JUCEboxAudioProcessor::createEditor()
+{
+   #if JUCEBOX_HEADLESS
+    return nullptr;
+   #else
+    return new JUCEboxAudioProcessorEditor (*this);
+   #endif
+}
+
+SessionState JUCEboxAudioProcessor::createSessionState()
+{
+    SessionState state;
+    
+    for (auto* parameter : getParameters())
+        if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*> (parameter))
+            state.parameters.push_back ({ ranged->getParameterID(), ranged->getValue() });
+    
+    const auto layers = copyLoopLayers ([&]
     {
-        loopPositionSamples += buffer.getNumSamples();
-        if (loopPositionSamples >= loopLengthSamples)
-            loopPositionSamples = 0;
-    }
+        state.hostSync = hostSync;
+        state.playing = loopPlaying;
+    });
+    
+    for (const auto& entry : layers)
+        state.layers.push_back ({ entry.volume, entry.muted, entry.layer->events });
     
-    auto gain = apvts.getRawParameterValue ("GAIN")->load();
-    buffer.applyGain (gain);
+    return state;
+}
+
+void JUCEboxAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
+{
+    createSessionState().writeTo (destData);
 }
 
-bool JUCEboxAudioProcessor::hasEditor() const { return true; }
-juce::AudioProcessorEditor* JUCEboxAudioProcessor::createEditor() { return new JUCEboxAudioProcessorEditor (*this); }
-void JUCEboxAudioProcessor::getStateInformation (juce::MemoryBlock&) {}
-void JUCEboxAudioProcessor::setStateInformation (const void*, int) {}
+void JUCEboxAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
+{
+    SessionState state;
+    
+    if (data == nullptr || sizeInBytes <= 0 || ! state.readFrom (data, (size_t) sizeInBytes))
+        return;
+    
+    for (const auto& p : state.parameters)
+        if (auto* parameter = apvts.getParameter (p.id))
+            parameter->setValueNotifyingHost (p.value);
+    
+    std::vector<LoopVersion::Entry> layers;
+    
+    for (auto& layer : state.layers)
+        if (! layer.events.empty())
+            layers.push_back ({ std::make_shared<LoopLayer> (LoopLayer { std::move (layer.events) }), layer.volume, layer.muted });
+    
+    const auto hasLoop = ! layers.empty();
+    
+    // Decoding and building the layers is done, so the audio thread only ever waits
+    // for a few assignments. The history isn't touched under the callback lock, since
+    // its own lock can be held for a while. The take is dropped first, so none can be
+    // sent after reset() has marked what it discards, and the new version is picked
+    // up on the audio thread's next block.
+    {
+        const juce::ScopedLock lock (getCallbackLock());
+        loopTimeline.clear();
+        takeAwaitingLayer = 0;
+        recording = wasRecording = recordingRequested = false;
+        loopPlaying = false;
+    }
+    
+    loopHistory.reset (std::move (layers));
+    
+    const juce::ScopedLock lock (getCallbackLock());
+    
+    loopPlaying = state.playing && hasLoop;
+    loopPositionTicks = 0.0;
+    lastMetronomeBeat = -1;
+    hostSync = state.hostSync;
+    hostPlaying = false;
+    
+    bankSynth.allNotesOff (false);
+    synth.allNotesOff (0, false);
+}
 
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter() { return new JUCEboxAudioProcessor(); }
@@ -1,21 +1,69 @@
 #pragma once
 #include <JuceHeader.h>
+#include "CommandQueue.h"
+#include "LoopTimeline.h"
+#include "RealtimeAllocationGuard.h"
+#include "SineOscillator.h"
+#include "ReleaseEnvelope.h"
+#include "SeqLock.h"
+#include "VoiceBank.h"
+#include "MetronomeClicks.h"
+#include "PerformanceMonitor.h"
+#include "SessionState.h"
+#include "LoopFileWorker.h"
+#include "LoopHistory.h"
+
+// Set by console targets that build the processor without juce_gui_basics
+#ifndef JUCEBOX_HEADLESS
+ #define JUCEBOX_HEADLESS 0
+#endif
+
+class LoopBouncer;
+class StealingSynthesiser;
 
 class SineWaveVoice : public juce::SynthesiserVoice
 {
 public:
+    SineWaveVoice() { SineTable::get(); }
+    
     bool canPlaySound (juce::SynthesiserSound* sound) override;
     void startNote (int midiNoteNumber, float velocity, juce::SynthesiserSound*, int) override;
     void stopNote (float velocity, bool allowTailOff) override;
     void pitchWheelMoved (int) override {}
     void controllerMoved (int, int) override {}
     void renderNextBlock (juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) override;
+    void setCurrentPlaybackSampleRate (double newRate) override;
+    
+    void setReleaseTime (double milliseconds) { envelope.setReleaseTime (milliseconds); }
+    
+    // Fades the note out over VoiceBank::stealFadeMs, as the voice bank does with a
+    // voice it steals. A stolen voice no longer counts against the polyphony.
+    void startFade();
+    bool isStolen() const { return stolen; }
+    bool isReleasing() const { return envelope.isReleasing(); }
+    float getLevel() const { return (float) level * envelope.getGain(); }
+    
+    // Tells the synth when this voice starts and stops, so it can keep its voices
+    // on a free list instead of searching them for every note
+    void setOwner (StealingSynthesiser* synth, int voiceIndex) { owner = synth; index = voiceIndex; }
+    
+    // Mono buffer the voice renders into before it is added to each output channel.
+    // Voices render one at a time on the audio thread, so they can all share one.
+    void setScratchBuffer (float* data, int size) { scratch = data; scratchSize = size; }
 
 private:
-    double currentAngle = 0.0;
-    double angleDelta = 0.0;
+    int renderToScratch (int numSamples);
+    void finishNote();
+    
+    SineOscillator oscillator;
+    ReleaseEnvelope envelope;
     double level = 0.0;
-    double tailOff = 0.0;
+    bool playing = false;
+    bool stolen = false;
+    StealingSynthesiser* owner = nullptr;
+    int index = 0;
+    float* scratch = nullptr;
+    int scratchSize = 0;
 };
 
 class SineWaveSound : public juce::SynthesiserSound
@@ -25,12 +73,76 @@ public:
     bool appliesToChannel (int) override { return true; }
 };
 
-struct RecordedNote
+// juce::Synthesiser with the voice bank's polyphony limit and steal policies.
+// It is given more SineWaveVoices than the polyphony, so that a stolen voice can
+// fade out while the note that stole it starts on a spare one. As in VoiceBank,
+// free voices are kept as a stack and the sounding ones counted, so taking a
+// voice is O(1); only a steal has to look through the voices for a victim.
+class StealingSynthesiser : public juce::Synthesiser
+{
+public:
+    // Not real-time safe: adds SineWaveVoices, the only kind this may be given
+    void addSineVoices (int numVoices);
+    
+    void setPolyphony (int numVoices, VoiceBank::StealPolicy policy) { polyphony = juce::jmax (1, numVoices); stealPolicy = policy; }
+    
+    // Voices making any sound, stolen ones still fading out included
+    int getNumActiveVoices() const { return numActive; }
+
+protected:
+    juce::SynthesiserVoice* findFreeVoice (juce::SynthesiserSound*, int midiChannel, int midiNoteNumber, bool) const override;
+
+private:
+    friend class SineWaveVoice;
+    void voiceStarted (int index);
+    void voiceStolen()   { --numSounding; }
+    void voiceStopped (int index, bool wasStolen);
+    
+    SineWaveVoice* getSineVoice (int index) const { return static_cast<SineWaveVoice*> (voices.getUnchecked (index)); }
+    SineWaveVoice* findVictim() const;
+    SineWaveVoice* findFadingVoice() const;
+
+    int polyphony = 1;
+    VoiceBank::StealPolicy stealPolicy = VoiceBank::StealPolicy::oldest;
+    
+    // freeVoices[0, numFree) are the idle voices; freePosition finds one in there
+    std::vector<int> freeVoices, freePosition;
+    int numFree = 0, numActive = 0, numSounding = 0;
+};
+
+// Plays a VoiceBank from MIDI the same way juce::Synthesiser plays its voices:
+// the block is split at each event, so notes start and stop sample-accurately.
+class VoiceBankSynth
+{
+public:
+    void prepare (double sampleRate, int maximumBlockSize, int numVoices);
+    void renderNextBlock (juce::AudioBuffer<float>& outputBuffer, const juce::MidiBuffer& midi, int startSample, int numSamples);
+    void setPolyphony (int numVoices, VoiceBank::StealPolicy policy) { bank.setPolyphony (numVoices); bank.setStealPolicy (policy); }
+    void allNotesOff (bool allowTailOff) { bank.allNotesOff (allowTailOff); }
+    int getNumActiveVoices() const { return bank.getNumActiveVoices(); }
+    int getNumActiveSlots() const { return bank.getNumActiveSlots(); }
+    double getReleaseTime() const { return bank.getReleaseTime(); }
+
+private:
+    void handleMidiEvent (const juce::MidiMessage& msg);
+    
+    VoiceBank bank;
+    juce::AudioBuffer<float> mono;
+};
+
+// What the editor needs to draw the transport, published once per block.
+struct TransportSnapshot
 {
-    int noteNumber;
-    float velocity;
-    int64_t startSample;
-    int64_t endSample;
+    double loopPosition = 0.0;   // 0 to 1 through the loop
+    double tempo = 120.0;
+    int beat = -1;               // beat within the loop, -1 when stopped
+    int bar = -1;
+    int beatInBar = -1;
+    int activeVoices = 0;
+    bool recording = false;
+    bool playing = false;
+    bool metronomeOn = false;
+    bool hostSync = false;
 };
 
 class JUCEboxAudioProcessor : public juce::AudioProcessor
@@ -59,55 +171,218 @@ public:
     const juce::String getProgramName (int index) override;
     void changeProgramName (int index, const juce::String& newName) override;
 
+    // The parameters, transport flags and recorded loop, as a SessionState
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
     
     juce::MidiKeyboardState& getKeyboardState() { return keyboardState; }
     
-    // Looper functions
+    // Looper functions. The transport calls below only queue a command, which the
+    // audio thread applies at the start of its next block; call them from one thread.
     void toggleRecording();
-    void clearLoop();
-    bool isRecording() const { return recording; }
-    bool isPlaying() const { return loopPlaying; }
-    double getLoopPosition() const;
-    int getCurrentBeat() const;
+    void overdub();      // records a new layer over the loop, starting it if it's stopped
+    void clearLoop();    // can be undone
+    
+    // The loop's layers, their mute and volume, and undo and redo. Call from the message thread.
+    LoopHistory& getLoopHistory() { return loopHistory; }
+    void setLoopCapacity (int maxEvents, LoopTimeline::OverflowPolicy policy);
+    
+    // The loop as a Standard MIDI File, read and written on a background thread.
+    // An import replaces the loop at the start of a block, then sets the tempo and
+    // time signature parameters from the file. Call these from the message thread;
+    // onDone is called there too.
+    void exportLoop (const juce::File& file, LoopFileWorker::ExportCallback onDone);
+    void importLoop (const juce::File& file, std::function<void (bool succeeded)> onDone);
+    
+    // The loop rendered offline, numLoops times round plus the release tail, through
+    // the same engine as processBlock, and written as WAV or FLAC (by the file's
+    // extension) on a pool of background threads. With stems, each unmuted layer is
+    // rendered on its own, to a file named after `file` with the layer's number.
+    // Call from the message thread; onDone is called there with how many files were
+    // written and how many times faster than real time the whole export went.
+    using AudioExportCallback = std::function<void (bool succeeded, int numFiles, double speedUp)>;
+    void exportAudio (const juce::File& file, int numLoops, bool stems, AudioExportCallback onDone);
     
-    // Metronome
+    // Safe from any thread: a copy of the state as of the end of the last block
+    TransportSnapshot getTransportSnapshot() const { return transportSnapshot.load(); }
+    
+    // When on, the loop position, tempo, time signature and metronome follow the
+    // host's transport, and the loop only runs while the host is playing
+    void setHostSync (bool shouldSync);
+    bool isHostSynced() const { return getTransportSnapshot().hostSync; }
+    
+    // Metronome. This and the tempo are host parameters; call these from the message thread
     void toggleMetronome();
-    bool isMetronomeOn() const { return metronomeOn; }
+    // Replaces a built-in click from the next prepareToPlay; returns false if the file can't be read
+    bool loadClickSample (MetronomeClicks::Click click, const juce::File& file) { return metronomeClicks.loadSample (click, file); }
     
     // Tempo
     void setTempo (double bpm);
-    double getTempo() const { return tempo; }
+    double getTempo() const { return getTransportSnapshot().tempo; }
+    
+    // Voice engine, applied on the next prepareToPlay
+    enum class SynthEngine { synthesiserVoices, voiceBank };
+    void setSynthEngine (SynthEngine engine) { requestedSynthEngine = engine; }
+    SynthEngine getSynthEngine() const { return synthEngine; }
+    int getNumActiveVoices() const;
+    
+    // Polyphony and voice stealing are host parameters, applied to either engine from
+    // the next block; call these from the message thread
+    static constexpr int defaultPolyphony = 128;
+    static constexpr int maxPolyphony = 256;
+    void setPolyphony (int numVoices, VoiceBank::StealPolicy stealing);
+    int getPolyphony() const { return juce::roundToInt (polyphonyParameter->load()); }
+    
+    // Block timings and counters; read from a single non-audio thread
+    PerformanceMonitor& getPerformanceMonitor() { return performanceMonitor; }
 
     juce::AudioProcessorValueTreeState apvts;
     
 private:
-    juce::Synthesiser synth;
-    juce::Synthesiser metronomeSynth;
+    StealingSynthesiser synth;
+    VoiceBankSynth bankSynth;
+    SynthEngine synthEngine = SynthEngine::voiceBank;
+    SynthEngine requestedSynthEngine = SynthEngine::voiceBank;
     juce::MidiKeyboardState keyboardState;
     juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
     
-    // Looper state
+    // Audio-thread scratch, sized in prepareToPlay so processBlock never allocates
+    static constexpr int maxMidiEventsPerBlock = 2048;
+    juce::MidiBuffer synthMidi;
+    juce::MidiBuffer loopMidi;
+    juce::AudioBuffer<float> voiceScratch;
+    
+    // Transport commands from the message thread, drained at the top of processBlock
+    struct TransportCommand
+    {
+        enum class Type { toggleRecording, overdub, clearLoop, setHostSync };
+        Type type;
+        double value = 0.0;
+    };
+    
+    CommandQueue<TransportCommand, 64> transportCommands;
+    void pushCommand (TransportCommand command);
+    void handleCommand (const TransportCommand& command);
+    void handleToggleRecording();
+    void startRecording();
+    
+    // Looper state, owned by the audio thread. The loop plays as the layers of the
+    // current LoopVersion, plus the take being recorded, which keeps playing from
+    // loopTimeline until the version it has become a layer of arrives.
     bool recording = false;
+    bool wasRecording = false;
+    bool recordingRequested = false;   // waiting on the last take before starting the next
     bool loopPlaying = false;
-    std::vector<RecordedNote> recordedNotes;
-    std::map<int, int64_t> activeNoteStarts;
-    int64_t loopLengthSamples = 0;
-    int64_t loopPositionSamples = 0;
+    LayerPlayer loopLayers;
+    LoopTimeline loopTimeline;
+    uint64_t takeAwaitingLayer = 0;
+    bool takeActive = false;
+    int loopCapacity = LoopTimeline::defaultCapacity;
+    LoopTimeline::OverflowPolicy loopOverflowPolicy = LoopTimeline::OverflowPolicy::dropNewest;
+    double loopPositionTicks = 0.0;
+    BlockTicks blockTicks;
     double sampleRate = 44100.0;
+    int64_t getLoopLengthTicks() const { return loopLengthTicks; }
+    void seekLoop (double tick);
+    void seekPlayback (int64_t tick);
+    void releaseLoopNote (const LoopEvent& e);
+    void addLoopEvent (const LoopEvent& e, float gain);
+    void takeLoopVersion();
+    void submitTake();
+    
+    // The current layers plus the take, if it isn't one of them yet, copied from
+    // the message thread. whileLocked () runs while the audio thread is held off.
+    template <typename Fn>
+    std::vector<LoopVersion::Entry> copyLoopLayers (Fn&& whileLocked);
+    
+    // The take is copied by the audio thread itself, at the top of a block, into a
+    // buffer the message thread has reserved, so the callback lock is never held
+    // for the length of a take. Only if no block comes is it copied under the lock.
+    struct TakeCopy
+    {
+        std::vector<LoopEvent> events;
+        int numEvents = 0;                 // in the take; more than events' capacity means try again
+        uint64_t playingSerial = 0;        // of the version playing when it was copied
+        uint64_t takeAwaitingLayer = 0;
+        std::atomic<bool> done { false };
+    };
+    std::atomic<TakeCopy*> takeCopyRequest { nullptr };
+    void copyTake (TakeCopy& copy);
+    void serveTakeCopy();
+    
+    // Builds and frees versions of the loop, and the layers takes become, off the audio thread
+    LoopHistory loopHistory;
+    LoopFileWorker loopFileWorker;
+    
+    // Created by the first exportAudio(), since its pool starts a thread per core
+    std::unique_ptr<LoopBouncer> loopBouncer;
+    
+    // The parameters, transport flags and layers, as getStateInformation() saves them
+    SessionState createSessionState();
+    
+    // Host sync. The clock runs while the looper plays, or in sync mode while the host does
+    bool hostSync = false;
+    bool hostPlaying = false;
+    bool isClockRunning() const { return hostSync ? hostPlaying : loopPlaying; }
+    bool isLoopRunning() const { return loopPlaying && isClockRunning(); }
+    void followHostTransport();
     
     // Metronome state
     bool metronomeOn = false;
     int64_t lastMetronomeBeat = -1;
+    MetronomeClicks metronomeClicks;
     
-    // Tempo
+    PerformanceMonitor performanceMonitor;
+    SeqLock<TransportSnapshot> transportSnapshot;
+    void publishTransportSnapshot();
+    bool isAnyVoiceRendering() const;
+    
+    // Parameters, looked up once at construction. Each block reads them into the
+    // fields below, and the values derived from those are only recomputed when one moves.
+    std::atomic<float>* gainParameter = nullptr;
+    std::atomic<float>* tempoParameter = nullptr;
+    std::atomic<float>* metronomeParameter = nullptr;
+    std::atomic<float>* beatsPerBarParameter = nullptr;
+    std::atomic<float>* numBarsParameter = nullptr;
+    std::atomic<float>* polyphonyParameter = nullptr;
+    std::atomic<float>* stealingParameter = nullptr;
+    void readParameters();
+    void updateTiming();
+    void setParameterValue (const juce::String& id, float value);
+    
+    // Gain is ramped sample by sample through gainRamp, sized in prepareToPlay
+    juce::LinearSmoothedValue<float> smoothedGain;
+    juce::AudioBuffer<float> gainRamp;
+    void applyGain (juce::AudioBuffer<float>& buffer);
+    
+    // Tempo and time signature, from the parameters or, in sync mode, the host
     double tempo = 120.0;
     int beatsPerBar = 4;
+    int beatUnit = 4;     // the time signature's denominator
     int numBars = 4;
+    int64_t getTicksPerBeat() const { return (int64_t) ticksPerQuarterNote * 4 / beatUnit; }
+    
+    // Derived from the above by updateTiming()
+    double samplesPerTick = 1.0;
+    int64_t loopLengthTicks = 0;
+    struct TimingKey
+    {
+        double sampleRate, tempo;
+        int beatsPerBar, beatUnit, numBars;
+        bool operator== (const TimingKey& other) const
+        {
+            return sampleRate == other.sampleRate && tempo == other.tempo && beatsPerBar == other.beatsPerBar
+                && beatUnit == other.beatUnit && numBars == other.numBars;
+        }
+    };
+    TimingKey timingKey {};
     
-    void processMetronome (juce::MidiBuffer& midiMessages, int numSamples);
-    void processLoopPlayback (juce::MidiBuffer& midiMessages, int numSamples);
+    // One run of the block within a single cycle of the loop, described by blockTicks
+    void processSegment();
+    void processMetronome();
+    void processLoopPlayback (int64_t endTick);
+    void captureRecording();
     
+    JUCE_DECLARE_WEAK_REFERENCEABLE (JUCEboxAudioProcessor)
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (JUCEboxAudioProcessor)
 };
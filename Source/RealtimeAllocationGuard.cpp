@@ -0,0 +1,84 @@
+#include "RealtimeAllocationGuard.h"
+
+#if JUCEBOX_CHECK_REALTIME_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    thread_local int guardDepth = 0;
+    std::atomic<int> numViolations { 0 };
+
+    void reportViolation() noexcept
+    {
+        ++numViolations;
+
+        // The assertion machinery may itself allocate, so drop the guard while reporting.
+        const auto depth = guardDepth;
+        guardDepth = 0;
+        jassertfalse; // heap allocation or deallocation on the audio thread
+        guardDepth = depth;
+    }
+
+    void checkRealtimeAllocation() noexcept
+    {
+        if (guardDepth > 0)
+            reportViolation();
+    }
+
+    void* allocate (std::size_t size)
+    {
+        checkRealtimeAllocation();
+
+        if (auto* p = std::malloc (size != 0 ? size : 1))
+            return p;
+
+        throw std::bad_alloc();
+    }
+
+    void deallocate (void* p) noexcept
+    {
+        if (p != nullptr)
+            checkRealtimeAllocation();
+
+        std::free (p);
+    }
+}
+
+ScopedRealtimeAllocationGuard::ScopedRealtimeAllocationGuard() noexcept   { ++guardDepth; }
+ScopedRealtimeAllocationGuard::~ScopedRealtimeAllocationGuard() noexcept  { --guardDepth; }
+
+ScopedMidiCapacityCheck::ScopedMidiCapacityCheck (std::initializer_list<const juce::MidiBuffer*> buffersToWatch) noexcept
+{
+    jassert (buffersToWatch.size() <= maxBuffers);
+
+    for (auto* buffer : buffersToWatch)
+    {
+        if (numBuffers == maxBuffers)
+            break;
+
+        buffers[numBuffers] = buffer;
+        capacities[numBuffers] = buffer->data.getNumAllocated();
+        ++numBuffers;
+    }
+}
+
+ScopedMidiCapacityCheck::~ScopedMidiCapacityCheck() noexcept
+{
+    for (size_t i = 0; i < numBuffers; ++i)
+        if (buffers[i]->data.getNumAllocated() != capacities[i])
+            reportViolation();   // a MidiBuffer grew on the audio thread
+}
+
+int getNumRealtimeAllocationViolations() noexcept   { return numViolations.load(); }
+
+void* operator new (std::size_t size)                    { return allocate (size); }
+void* operator new[] (std::size_t size)                  { return allocate (size); }
+void operator delete (void* p) noexcept                  { deallocate (p); }
+void operator delete[] (void* p) noexcept                { deallocate (p); }
+void operator delete (void* p, std::size_t) noexcept     { deallocate (p); }
+void operator delete[] (void* p, std::size_t) noexcept   { deallocate (p); }
+
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+#include <JuceHeader.h>
+
+#ifndef JUCEBOX_CHECK_REALTIME_ALLOCATIONS
+ #define JUCEBOX_CHECK_REALTIME_ALLOCATIONS JUCE_DEBUG
+#endif
+
+// While one of these is alive, any operator new / delete on the same thread
+// triggers an assertion. Used to keep the audio callback allocation-free; it
+// compiles to nothing unless JUCEBOX_CHECK_REALTIME_ALLOCATIONS is set, which
+// it is by default in debug builds.
+class ScopedRealtimeAllocationGuard
+{
+public:
+#if JUCEBOX_CHECK_REALTIME_ALLOCATIONS
+    ScopedRealtimeAllocationGuard() noexcept;
+    ~ScopedRealtimeAllocationGuard() noexcept;
+#else
+    ScopedRealtimeAllocationGuard() noexcept {}
+#endif
+
+    JUCE_DECLARE_NON_COPYABLE (ScopedRealtimeAllocationGuard)
+};
+
+// MidiBuffers grow through HeapBlock, which calls std::malloc and std::realloc
+// directly and so slips past the guard above. This asserts instead if any of the
+// buffers it watches has had to grow by the time it goes out of scope, which means
+// a block carried more events than prepareToPlay made room for.
+class ScopedMidiCapacityCheck
+{
+public:
+#if JUCEBOX_CHECK_REALTIME_ALLOCATIONS
+    ScopedMidiCapacityCheck (std::initializer_list<const juce::MidiBuffer*> buffersToWatch) noexcept;
+    ~ScopedMidiCapacityCheck() noexcept;
+#else
+    ScopedMidiCapacityCheck (std::initializer_list<const juce::MidiBuffer*>) noexcept {}
+#endif
+
+private:
+#if JUCEBOX_CHECK_REALTIME_ALLOCATIONS
+    static constexpr size_t maxBuffers = 4;
+    const juce::MidiBuffer* buffers[maxBuffers] {};
+    int capacities[maxBuffers] {};
+    size_t numBuffers = 0;
+#endif
+
+    JUCE_DECLARE_NON_COPYABLE (ScopedMidiCapacityCheck)
+};
+
+// How many times either of the above has asserted, so a test can expect it to.
+// Always 0 when the checks are compiled out.
+#if JUCEBOX_CHECK_REALTIME_ALLOCATIONS
+int getNumRealtimeAllocationViolations() noexcept;
+#else
+inline int getNumRealtimeAllocationViolations() noexcept { return 0; }
+#endif
@@ -0,0 +1,118 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Exponential release from full level down to floorGain over a fixed time in
+// milliseconds, independent of the sample rate. The number of samples left is
+// known when the release starts, and gains are applied as short linear ramps
+// between exact exponential points, so the per-sample loop has no branches.
+class ReleaseEnvelope
+{
+public:
+    static constexpr float floorGain = 0.005f;   // about -46 dB, where the voice is cut
+    static constexpr int rampLength = 32;
+
+    ReleaseEnvelope() { updateCoefficients(); }
+
+    void setSampleRate (double newSampleRate)   { sampleRate = newSampleRate; updateCoefficients(); }
+    void setReleaseTime (double milliseconds)   { releaseMs = milliseconds; updateCoefficients(); }
+    double getReleaseTime() const noexcept      { return releaseMs; }
+
+    void reset() noexcept
+    {
+        if (fading)
+            updateCoefficients();
+
+        releasing = fading = false;
+        gain = 1.0f;
+        samplesRemaining = 0;
+    }
+
+    void startRelease() noexcept
+    {
+        if (releasing)
+            return;
+
+        releasing = true;
+        gain = 1.0f;
+        samplesRemaining = releaseSamples;
+    }
+
+    // A much shorter release from wherever the gain is now, for a voice that is
+    // stolen. A release already closer to its end than that is left alone.
+    void startFade (double milliseconds) noexcept
+    {
+        const auto fadeSamples = juce::jmax (1, juce::roundToInt (milliseconds * sampleRate / 1000.0));
+
+        if (releasing && samplesRemaining <= fadeSamples)
+            return;
+
+        releasing = fading = true;
+        samplesRemaining = fadeSamples;
+        sampleCoefficient = (float) std::pow ((double) floorGain / gain, 1.0 / fadeSamples);
+        rampCoefficient = std::pow (sampleCoefficient, (float) rampLength);
+    }
+
+    bool isReleasing() const noexcept   { return releasing; }
+    float getGain() const noexcept      { return gain; }
+    bool isFinished() const noexcept    { return releasing && samplesRemaining == 0; }
+
+    // How many of the next numSamples are still audible.
+    int getSamplesToRender (int numSamples) const noexcept
+    {
+        return releasing ? juce::jmin (numSamples, samplesRemaining) : numSamples;
+    }
+
+    // Applies the envelope to the first numSamples, which must not exceed getSamplesToRender().
+    void process (float* samples, int numSamples) noexcept
+    {
+        if (! releasing)
+            return;
+
+        jassert (numSamples <= samplesRemaining);
+
+        int done = 0;
+
+        for (; done + rampLength <= numSamples; done += rampLength)
+        {
+            const auto end = gain * rampCoefficient;
+            applyRamp (samples + done, rampLength, end);
+        }
+
+        if (done < numSamples)
+        {
+            const auto length = numSamples - done;
+            applyRamp (samples + done, length, gain * std::pow (sampleCoefficient, (float) length));
+        }
+
+        samplesRemaining -= numSamples;
+    }
+
+private:
+    void applyRamp (float* samples, int length, float end) noexcept
+    {
+        const auto step = (end - gain) / (float) length;
+
+        for (int i = 0; i < length; ++i)
+            samples[i] *= gain + step * (float) i;
+
+        gain = end;
+    }
+
+    void updateCoefficients()
+    {
+        releaseSamples = juce::jmax (1, juce::roundToInt (releaseMs * sampleRate / 1000.0));
+        sampleCoefficient = (float) std::pow ((double) floorGain, 1.0 / releaseSamples);
+        rampCoefficient = std::pow (sampleCoefficient, (float) rampLength);
+    }
+
+    double sampleRate = 44100.0;
+    double releaseMs = 240.0;    // matches the old fixed 0.9995-per-sample tail at 44.1 kHz
+
+    int releaseSamples = 0;
+    float sampleCoefficient = 0.0f, rampCoefficient = 0.0f;
+
+    bool releasing = false;
+    bool fading = false;    // the coefficients are the fade's until the next reset
+    float gain = 1.0f;
+    int samplesRemaining = 0;
+};
@@ -0,0 +1,68 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Publishes a small trivially-copyable value from one writer thread to any number
+// of reader threads without locks. The writer never waits. A reader copies the
+// value in one pass and only retries if a write overlapped it, which for an
+// update once per audio block practically never happens. The value is held as
+// atomic words, so even a read that gets retried is not a data race.
+template <typename T>
+class SeqLock
+{
+public:
+    static_assert (std::is_trivially_copyable_v<T>, "SeqLock values are copied word by word");
+
+    SeqLock() noexcept { store (T {}); }
+
+    // Writer thread only
+    void store (const T& value) noexcept
+    {
+        std::array<uint64_t, numWords> words {};
+        std::memcpy (words.data(), &value, sizeof (T));
+
+        const auto seq = sequence.load (std::memory_order_relaxed);
+        sequence.store (seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+
+        for (size_t i = 0; i < numWords; ++i)
+            data[i].store (words[i], std::memory_order_relaxed);
+
+        sequence.store (seq + 2, std::memory_order_release);
+    }
+
+    // Any thread
+    T load() const noexcept
+    {
+        std::array<uint64_t, numWords> words;
+
+        for (;;)
+        {
+            const auto before = sequence.load (std::memory_order_acquire);
+
+            if ((before & 1) != 0)
+                continue;
+
+            for (size_t i = 0; i < numWords; ++i)
+                words[i] = data[i].load (std::memory_order_relaxed);
+
+            std::atomic_thread_fence (std::memory_order_acquire);
+
+            if (sequence.load (std::memory_order_relaxed) == before)
+                break;
+        }
+
+        T value;
+        std::memcpy (static_cast<void*> (&value), words.data(), sizeof (T));
+        return value;
+    }
+
+private:
+    static constexpr size_t numWords = (sizeof (T) + sizeof (uint64_t) - 1) / sizeof (uint64_t);
+
+    std::atomic<uint32_t> sequence { 0 };
+    std::array<std::atomic<uint64_t>, numWords> data {};
+};
@@ -0,0 +1,337 @@
+#include "SessionState.h"
+#include <cmath>
+#include <unordered_map>
+
+namespace
+{
+    constexpr char magic[] = { 'J', 'B', 'X', 'S' };
+    constexpr size_t maxVarintBytes = 10;
+
+    // Writes into memory sized for the worst case up front, so there are no
+    // bounds checks or reallocations per byte
+    struct Writer
+    {
+        uint8_t* out;
+
+        void byte (uint8_t b) noexcept    { *out++ = b; }
+
+        void varint (uint64_t value) noexcept
+        {
+            while (value >= 0x80)
+            {
+                byte ((uint8_t) (value | 0x80));
+                value >>= 7;
+            }
+
+            byte ((uint8_t) value);
+        }
+
+        void float32 (float value) noexcept
+        {
+            uint32_t bits;
+            std::memcpy (&bits, &value, sizeof (bits));
+
+            for (int i = 0; i < 4; ++i)
+                byte ((uint8_t) (bits >> (8 * i)));
+        }
+
+        void bytes (const void* data, size_t size) noexcept
+        {
+            std::memcpy (out, data, size);
+            out += size;
+        }
+    };
+
+    // Every read is bounds-checked; after the first failure ok stays false and
+    // everything reads as zero
+    struct Reader
+    {
+        const uint8_t* in;
+        const uint8_t* end;
+        bool ok = true;
+
+        size_t remaining() const noexcept   { return (size_t) (end - in); }
+
+        uint8_t byte() noexcept
+        {
+            if (in == end)
+            {
+                ok = false;
+                return 0;
+            }
+
+            return *in++;
+        }
+
+        uint64_t varint() noexcept
+        {
+            uint64_t value = 0;
+
+            // Away from the end no single byte needs checking
+            if (remaining() >= maxVarintBytes)
+            {
+                for (int shift = 0; shift < 64; shift += 7)
+                {
+                    const auto b = *in++;
+                    value |= (uint64_t) (b & 0x7f) << shift;
+
+                    if ((b & 0x80) == 0)
+                        return value;
+                }
+
+                ok = false;
+                return 0;
+            }
+
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                const auto b = byte();
+                value |= (uint64_t) (b & 0x7f) << shift;
+
+                if ((b & 0x80) == 0)
+                    return value;
+            }
+
+            ok = false;
+            return 0;
+        }
+
+        float float32() noexcept
+        {
+            uint32_t bits = 0;
+
+            for (int i = 0; i < 4; ++i)
+                bits |= (uint32_t) byte() << (8 * i);
+
+            float value;
+            std::memcpy (&value, &bits, sizeof (value));
+            return value;
+        }
+
+        const uint8_t* bytes (size_t size) noexcept
+        {
+            if (size > remaining())
+            {
+                ok = false;
+                return nullptr;
+            }
+
+            const auto* start = in;
+            in += size;
+            return start;
+        }
+    };
+
+    uint64_t zigzag (int64_t value) noexcept     { return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63); }
+    int64_t unzigzag (uint64_t value) noexcept   { return (int64_t) (value >> 1) ^ -(int64_t) (value & 1); }
+
+    // Where each note-on falls in the order of note-ons, so a note-off can refer
+    // back to it. A release whose note-on was evicted has nothing to refer to and
+    // is left out, which plays the same.
+    void writeEvents (Writer& w, const std::vector<LoopEvent>& events)
+    {
+        std::unordered_map<uint32_t, int64_t> noteOnIndex;
+        noteOnIndex.reserve (events.size());
+
+        for (const auto& e : events)
+            if (e.isNoteOn)
+                noteOnIndex.emplace (e.noteId, (int64_t) noteOnIndex.size());
+
+        auto isWritten = [&] (const LoopEvent& e) { return e.isNoteOn || noteOnIndex.count (e.noteId) != 0; };
+        w.varint ((uint64_t) std::count_if (events.begin(), events.end(), isWritten));
+
+        int64_t lastTime = 0, numNoteOns = 0;
+        float lastVelocity = 0.0f;
+
+        for (const auto& e : events)
+        {
+            if (! isWritten (e))
+                continue;
+
+            jassert (e.time >= lastTime);
+
+            const auto delta = (uint64_t) juce::jmax ((int64_t) 0, e.time - lastTime);
+            const auto writeVelocity = e.isNoteOn && e.velocity != lastVelocity;
+
+            w.varint ((delta << 2) | (writeVelocity ? 2u : 0u) | (e.isNoteOn ? 1u : 0u));
+            w.byte (e.noteNumber);
+
+            if (e.isNoteOn)
+            {
+                ++numNoteOns;
+
+                if (writeVelocity)
+                {
+                    w.float32 (e.velocity);
+                    lastVelocity = e.velocity;
+                }
+            }
+            else
+            {
+                w.varint (zigzag (numNoteOns - noteOnIndex[e.noteId]));
+            }
+
+            lastTime += (int64_t) delta;
+        }
+    }
+
+    bool readEvents (Reader& r, std::vector<LoopEvent>& events)
+    {
+        const auto numEvents = r.varint();
+
+        if (! r.ok || numEvents > r.remaining() / 2)
+            return false;
+
+        events.resize ((size_t) numEvents);
+
+        int64_t time = 0, numNoteOns = 0, maxNoteOn = 0;
+        float velocity = 0.0f;
+
+        for (auto& e : events)
+        {
+            const auto tag = r.varint();
+            time += (int64_t) (tag >> 2);
+
+            e.time = time;
+            e.isNoteOn = (tag & 1) != 0;
+            e.noteNumber = (uint8_t) (r.byte() & 127);
+            e.velocity = 0.0f;
+
+            if (e.isNoteOn)
+            {
+                if ((tag & 2) != 0)
+                    velocity = r.float32();
+
+                if (! std::isfinite (velocity))
+                    return false;
+
+                e.velocity = velocity;
+                e.noteId = (uint32_t) ++numNoteOns;
+            }
+            else
+            {
+                // Note-ons are numbered from 1 in the order they come
+                const auto noteOn = numNoteOns + 1 - unzigzag (r.varint());
+
+                if (noteOn < 1)
+                    return false;
+
+                maxNoteOn = juce::jmax (maxNoteOn, noteOn);
+                e.noteId = (uint32_t) noteOn;
+            }
+        }
+
+        return r.ok && maxNoteOn <= numNoteOns;
+    }
+}
+
+void SessionState::writeTo (juce::MemoryBlock& dest) const
+{
+    auto bound = sizeof (magic) + 4 * maxVarintBytes;
+
+    for (const auto& p : parameters)
+        bound += maxVarintBytes + p.id.getNumBytesAsUTF8() + 4;
+
+    for (const auto& layer : layers)
+        bound += 2 * maxVarintBytes + 4 + layer.events.size() * (2 * maxVarintBytes + 1 + 4);
+
+    dest.setSize (bound);
+    Writer w { static_cast<uint8_t*> (dest.getData()) };
+
+    w.bytes (magic, sizeof (magic));
+    w.varint (currentVersion);
+    w.varint ((hostSync ? 1u : 0u) | (playing ? 2u : 0u));
+
+    w.varint (parameters.size());
+
+    for (const auto& p : parameters)
+    {
+        const auto size = p.id.getNumBytesAsUTF8();
+        w.varint (size);
+        w.bytes (p.id.toRawUTF8(), size);
+        w.float32 (p.value);
+    }
+
+    w.varint (layers.size());
+
+    for (const auto& layer : layers)
+    {
+        w.varint (layer.muted ? 1u : 0u);
+        w.float32 (layer.volume);
+        writeEvents (w, layer.events);
+    }
+
+    dest.setSize ((size_t) (w.out - static_cast<uint8_t*> (dest.getData())));
+}
+
+bool SessionState::readFrom (const void* data, size_t numBytes)
+{
+    Reader r { static_cast<const uint8_t*> (data), static_cast<const uint8_t*> (data) + numBytes };
+
+    const auto* header = r.bytes (sizeof (magic));
+
+    if (header == nullptr || std::memcmp (header, magic, sizeof (magic)) != 0)
+        return false;
+
+    const auto version = r.varint();
+
+    if (! r.ok || version < 1 || version > (uint64_t) currentVersion)
+        return false;
+
+    const auto flags = r.varint();
+    hostSync = (flags & 1) != 0;
+    playing = (flags & 2) != 0;
+
+    // Each parameter and event takes at least a few bytes, which bounds the counts
+    // before anything is allocated for them
+    const auto numParameters = r.varint();
+
+    if (! r.ok || numParameters > r.remaining() / 5)
+        return false;
+
+    parameters.clear();
+    parameters.reserve ((size_t) numParameters);
+
+    for (uint64_t i = 0; i < numParameters && r.ok; ++i)
+    {
+        const auto size = (size_t) r.varint();
+        const auto* id = r.bytes (size);
+        const auto value = r.float32();
+
+        if (! std::isfinite (value))
+            return false;
+
+        if (r.ok)
+            parameters.push_back ({ juce::String::fromUTF8 (reinterpret_cast<const char*> (id), (int) size), value });
+    }
+
+    if (version == 1)
+    {
+        layers.resize (1);
+        layers[0] = {};
+        return readEvents (r, layers[0].events);
+    }
+
+    const auto numLayers = r.varint();
+
+    if (! r.ok || numLayers > r.remaining() / 6)
+        return false;
+
+    layers.resize ((size_t) numLayers);
+
+    for (auto& layer : layers)
+    {
+        layer.muted = (r.varint() & 1) != 0;
+        const auto volume = r.float32();
+
+        if (! std::isfinite (volume))
+            return false;
+
+        layer.volume = juce::jlimit (0.0f, 1.0f, volume);
+
+        if (! readEvents (r, layer.events))
+            return false;
+    }
+
+    return r.ok;
+}
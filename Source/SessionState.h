@@ -0,0 +1,53 @@
+#pragma once
+#include <JuceHeader.h>
+#include "LoopTimeline.h"
+
+// What the plugin saves with a host session: the parameters, the looper's
+// transport flags and the recorded loop, in a compact versioned binary form.
+//
+// Layout, all integers as unsigned LEB128 varints:
+//   "JBXS", version, flags (bit 0 host sync, bit 1 loop playing)
+//   parameter count, then per parameter: ID length, ID bytes, normalised value (float32 LE)
+//   layer count, then per layer: flags (bit 0 muted), volume (float32 LE) and
+//   event count, then per event, in time order:
+//     (ticks since the previous event << 2) | (velocity follows << 1) | isNoteOn,
+//     note number (one byte), then
+//     for a note-on, its velocity (float32 LE) if it differs from the last one written;
+//     for a note-off, how many note-ons back its own note-on is (zigzag, since the
+//     note-on of a note held across the loop end comes later)
+//
+// Note ids are rebuilt from those distances on load, so notes pair up exactly as
+// they were recorded, without any matching by pitch. A typical event is three to
+// five bytes. Version 1 had a single layer's event count and events in place of
+// the layers.
+//
+// Parameters are matched by ID on load, so ones added or removed since the
+// state was saved are simply left alone.
+struct SessionState
+{
+    static constexpr int currentVersion = 2;
+
+    struct Parameter
+    {
+        juce::String id;
+        float value;   // normalised, 0 to 1
+    };
+
+    struct Layer
+    {
+        float volume = 1.0f;
+        bool muted = false;
+        std::vector<LoopEvent> events;   // in time order; loaded ids count up from 1
+    };
+
+    std::vector<Parameter> parameters;
+    bool hostSync = false;
+    bool playing = false;
+    std::vector<Layer> layers;   // the looper's overdub layers, oldest first
+
+    void writeTo (juce::MemoryBlock& dest) const;
+
+    // Returns false, leaving this in an unspecified state, if the data isn't a
+    // session this version can read
+    bool readFrom (const void* data, size_t numBytes);
+};
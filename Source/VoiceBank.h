@@ -0,0 +1,397 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#ifndef JUCEBOX_VOICEBANK_LANES
+ #define JUCEBOX_VOICEBANK_LANES 8
+#endif
+
+// A polyphonic sine engine with all voice state stored as structure-of-arrays.
+// Voices are packed into groups of LaneWidth, and each group's oscillator,
+// level and release state lives in parallel arrays. The render loop runs over
+// a group with one lane per voice, so the compiler can keep a whole group in
+// SIMD registers. LaneWidth 1 is the scalar fallback.
+//
+// Each oscillator is a phasor: a unit complex number rotated by a fixed angle
+// every sample, whose imaginary part is the output. Rounding makes its
+// magnitude drift by roughly 1e-7 per sample, so it is pulled back onto the
+// unit circle at the end of every render call.
+//
+// This header deliberately has no JUCE dependency so that it can be
+// benchmarked on its own (see Benchmarks/VoiceBankBenchmark.cpp).
+template <int LaneWidth>
+class VoiceBankEngine
+{
+public:
+    static constexpr int laneWidth = LaneWidth;
+    static constexpr float releaseFloor = 0.005f;   // same -46 dB cut-off as ReleaseEnvelope
+    static constexpr double stealFadeMs = 3.0;
+
+    enum class StealPolicy
+    {
+        none,       // notes beyond the polyphony are dropped
+        oldest,     // take the voice that started longest ago
+        quietest    // take the voice with the lowest current level
+    };
+
+    // Not real-time safe: sizes the voice storage. maxVoices is the most the
+    // polyphony can be set to, and where it starts; a few extra slots are kept so
+    // that stolen voices can fade out while the note that stole them starts.
+    void prepare (double newSampleRate, int maxVoices)
+    {
+        sampleRate = newSampleRate;
+        numVoices = polyphony = std::max (1, maxVoices);
+        numSlots = numVoices + std::max (8, numVoices / 4);
+        groups.assign ((size_t) ((numSlots + LaneWidth - 1) / LaneWidth), LaneGroup());
+        voices.assign ((size_t) numSlots, VoiceInfo());
+        nextHeld.assign ((size_t) numSlots, -1);
+
+        // Lowest slots on top, so voices pack into as few lane groups as possible
+        freeSlots.resize ((size_t) numSlots);
+        for (int i = 0; i < numSlots; ++i)
+            freeSlots[(size_t) i] = numSlots - 1 - i;
+
+        numFree = numSlots;
+        numActive = numSounding = 0;
+        heldByNote.fill (-1);
+
+        setReleaseTime (releaseMs);
+        stealFadeSamples = std::max (1, (int) std::lround (stealFadeMs * sampleRate / 1000.0));
+        stealCoefficient = (float) std::pow ((double) releaseFloor, 1.0 / stealFadeSamples);
+    }
+
+    void setReleaseTime (double milliseconds)
+    {
+        releaseMs = milliseconds;
+        releaseSamples = std::max (1, (int) std::lround (releaseMs * sampleRate / 1000.0));
+        releaseCoefficient = (float) std::pow ((double) releaseFloor, 1.0 / releaseSamples);
+    }
+
+    double getReleaseTime() const noexcept                 { return releaseMs; }
+    void setStealPolicy (StealPolicy newPolicy) noexcept   { stealPolicy = newPolicy; }
+
+    // How many voices may sound at once, up to the number prepared. Lowering it
+    // cuts nothing straight away; the next note steals down to the new limit.
+    void setPolyphony (int newPolyphony) noexcept          { polyphony = std::max (1, std::min (newPolyphony, numVoices)); }
+    int getPolyphony() const noexcept                      { return polyphony; }
+
+    int getNumVoices() const noexcept        { return numVoices; }
+    int getNumActiveVoices() const noexcept  { return numSounding; }
+
+    // Every slot still making sound: the active voices and stolen ones fading out
+    int getNumActiveSlots() const noexcept   { return numActive; }
+
+    // Returns the slot used, or -1 if the note was dropped. Taking a slot is O(1);
+    // only a steal has to look through the voices for a victim.
+    int noteOn (int noteNumber, double frequencyHz, float level) noexcept
+    {
+        while (numSounding >= polyphony)
+        {
+            const auto victim = stealPolicy == StealPolicy::none ? -1 : findVictim();
+
+            if (victim < 0)
+                return -1;
+
+            startFade (victim);
+        }
+
+        // Every spare slot is still fading out a stolen voice: cut the one nearest the end
+        if (numFree == 0)
+            stopVoice (findFadingVoice());
+
+        const auto v = freeSlots[(size_t) --numFree];
+        startVoice (v, noteNumber, frequencyHz, level);
+        return v;
+    }
+
+    void noteOff (int noteNumber) noexcept
+    {
+        auto& head = heldByNote[(size_t) (noteNumber & 127)];
+
+        for (auto v = head; v >= 0; v = nextHeld[(size_t) v])
+            startRelease (v);
+
+        head = -1;
+    }
+
+    void allNotesOff (bool allowTailOff) noexcept
+    {
+        heldByNote.fill (-1);
+
+        for (int v = 0; v < numSlots; ++v)
+        {
+            if (! voices[(size_t) v].active)
+                continue;
+
+            if (allowTailOff)
+                startRelease (v);
+            else
+                stopVoice (v);
+        }
+    }
+
+    // Adds numSamples of the mono mix to output.
+    void render (float* output, int numSamples) noexcept
+    {
+        while (numSamples > 0)
+        {
+            const auto n = std::min (numSamples, chunkSize);
+            renderChunk (output, n);
+            output += n;
+            numSamples -= n;
+        }
+    }
+
+private:
+    static constexpr int chunkSize = 256;
+
+    struct alignas (64) LaneGroup
+    {
+        float re[LaneWidth] {}, im[LaneWidth] {};
+        float rotRe[LaneWidth] {}, rotIm[LaneWidth] {};
+        float amp[LaneWidth] {}, decay[LaneWidth] {};
+        int numActive = 0;
+    };
+
+    struct VoiceInfo
+    {
+        bool active = false;
+        bool releasing = false;
+        bool stolen = false;      // fading out, no longer counted against the polyphony
+        int noteNumber = -1;
+        int samplesRemaining = 0;
+        uint64_t startOrder = 0;
+    };
+
+    LaneGroup& groupFor (int voice) noexcept   { return groups[(size_t) (voice / LaneWidth)]; }
+    float levelOf (int voice) noexcept         { return groupFor (voice).amp[voice % LaneWidth]; }
+
+    void startVoice (int v, int noteNumber, double frequencyHz, float level) noexcept
+    {
+        auto& g = groupFor (v);
+        const auto lane = v % LaneWidth;
+        const auto w = 2.0 * 3.141592653589793 * frequencyHz / sampleRate;
+
+        g.re[lane] = 1.0f;
+        g.im[lane] = 0.0f;
+        g.rotRe[lane] = (float) std::cos (w);
+        g.rotIm[lane] = (float) std::sin (w);
+        g.amp[lane] = level;
+        g.decay[lane] = 1.0f;
+
+        ++g.numActive;
+        ++numActive;
+        ++numSounding;
+
+        noteNumber &= 127;
+        voices[(size_t) v] = { true, false, false, noteNumber, 0, ++startCounter };
+        nextHeld[(size_t) v] = heldByNote[(size_t) noteNumber];
+        heldByNote[(size_t) noteNumber] = v;
+    }
+
+    // Callers unlink the voice from heldByNote themselves.
+    void startRelease (int v) noexcept
+    {
+        auto& info = voices[(size_t) v];
+
+        if (info.releasing)
+            return;
+
+        info.releasing = true;
+        info.samplesRemaining = releaseSamples;
+        groupFor (v).decay[v % LaneWidth] = releaseCoefficient;
+    }
+
+    void startFade (int v) noexcept
+    {
+        auto& info = voices[(size_t) v];
+
+        if (info.releasing)
+            info.samplesRemaining = std::min (info.samplesRemaining, stealFadeSamples);
+        else
+            info.samplesRemaining = stealFadeSamples;
+
+        if (! info.releasing)
+            unlinkHeld (v);
+
+        info.releasing = info.stolen = true;
+        auto& decay = groupFor (v).decay[v % LaneWidth];
+        decay = std::min (decay, stealCoefficient);
+        --numSounding;
+    }
+
+    void stopVoice (int v) noexcept
+    {
+        auto& info = voices[(size_t) v];
+
+        if (! info.releasing)
+            unlinkHeld (v);
+
+        if (! info.stolen)
+            --numSounding;
+
+        auto& g = groupFor (v);
+        const auto lane = v % LaneWidth;
+        g.amp[lane] = 0.0f;
+        g.decay[lane] = 1.0f;
+        g.rotRe[lane] = 1.0f;
+        g.rotIm[lane] = 0.0f;
+
+        info = {};
+        --g.numActive;
+        --numActive;
+        freeSlots[(size_t) numFree++] = v;
+    }
+
+    void unlinkHeld (int v) noexcept
+    {
+        auto* link = &heldByNote[(size_t) voices[(size_t) v].noteNumber];
+
+        while (*link >= 0 && *link != v)
+            link = &nextHeld[(size_t) *link];
+
+        if (*link == v)
+            *link = nextHeld[(size_t) v];
+    }
+
+    // Releasing voices go first, then whichever the policy prefers.
+    int findVictim() noexcept
+    {
+        int best = -1;
+        bool bestReleasing = false;
+        float bestLevel = 0.0f;
+        uint64_t bestOrder = 0;
+
+        for (int v = 0; v < numSlots; ++v)
+        {
+            const auto& info = voices[(size_t) v];
+
+            if (! info.active || info.stolen)
+                continue;
+
+            const auto level = levelOf (v);
+            bool better = best < 0 || (info.releasing && ! bestReleasing);
+
+            if (! better && info.releasing == bestReleasing)
+                better = stealPolicy == StealPolicy::quietest ? level < bestLevel
+                                                              : info.startOrder < bestOrder;
+
+            if (better)
+            {
+                best = v;
+                bestReleasing = info.releasing;
+                bestLevel = level;
+                bestOrder = info.startOrder;
+            }
+        }
+
+        return best;
+    }
+
+    int findFadingVoice() noexcept
+    {
+        int best = 0;
+
+        for (int v = 0; v < numSlots; ++v)
+            if (voices[(size_t) v].stolen
+                 && (! voices[(size_t) best].stolen || voices[(size_t) v].samplesRemaining < voices[(size_t) best].samplesRemaining))
+                best = v;
+
+        return best;
+    }
+
+    void renderChunk (float* output, int numSamples) noexcept
+    {
+        if (numActive == 0)
+            return;
+
+        std::fill (laneMix, laneMix + numSamples * LaneWidth, 0.0f);
+
+        for (auto& g : groups)
+        {
+            if (g.numActive == 0)
+                continue;
+
+            // Work on local copies so the compiler knows nothing aliases the mix buffer
+            float re[LaneWidth], im[LaneWidth], rotRe[LaneWidth], rotIm[LaneWidth], amp[LaneWidth], decay[LaneWidth];
+            std::copy (g.re, g.re + LaneWidth, re);
+            std::copy (g.im, g.im + LaneWidth, im);
+            std::copy (g.rotRe, g.rotRe + LaneWidth, rotRe);
+            std::copy (g.rotIm, g.rotIm + LaneWidth, rotIm);
+            std::copy (g.amp, g.amp + LaneWidth, amp);
+            std::copy (g.decay, g.decay + LaneWidth, decay);
+
+            for (int s = 0; s < numSamples; ++s)
+            {
+                auto* mix = laneMix + s * LaneWidth;
+
+                for (int l = 0; l < LaneWidth; ++l)
+                {
+                    mix[l] += im[l] * amp[l];
+
+                    const auto nextRe = re[l] * rotRe[l] - im[l] * rotIm[l];
+                    const auto nextIm = re[l] * rotIm[l] + im[l] * rotRe[l];
+                    re[l] = nextRe;
+                    im[l] = nextIm;
+                    amp[l] *= decay[l];
+                }
+            }
+
+            // One Newton step towards |z| = 1 is plenty for the drift of a single chunk
+            for (int l = 0; l < LaneWidth; ++l)
+            {
+                const auto scale = 1.5f - 0.5f * (re[l] * re[l] + im[l] * im[l]);
+                g.re[l] = re[l] * scale;
+                g.im[l] = im[l] * scale;
+                g.amp[l] = amp[l];
+            }
+        }
+
+        for (int s = 0; s < numSamples; ++s)
+        {
+            float sum = 0.0f;
+
+            for (int l = 0; l < LaneWidth; ++l)
+                sum += laneMix[s * LaneWidth + l];
+
+            output[s] += sum;
+        }
+
+        // Releases and steal fades finish on chunk boundaries; the last few
+        // samples past the nominal end are already below releaseFloor.
+        for (int v = 0; v < numSlots; ++v)
+        {
+            auto& info = voices[(size_t) v];
+
+            if (info.releasing && (info.samplesRemaining -= numSamples) <= 0)
+                stopVoice (v);
+        }
+    }
+
+    double sampleRate = 44100.0;
+    double releaseMs = 240.0;
+    int releaseSamples = 1;
+    float releaseCoefficient = 1.0f;
+    int stealFadeSamples = 1;
+    float stealCoefficient = 1.0f;
+    StealPolicy stealPolicy = StealPolicy::oldest;
+
+    int numVoices = 0, polyphony = 0, numSlots = 0, numActive = 0, numSounding = 0;
+    std::vector<LaneGroup> groups;
+    std::vector<VoiceInfo> voices;
+
+    // Free slots as a stack, and the held (not yet released) voices of each
+    // note as a linked list threaded through nextHeld.
+    std::vector<int> freeSlots;
+    int numFree = 0;
+    std::array<int, 128> heldByNote {};
+    std::vector<int> nextHeld;
+    uint64_t startCounter = 0;
+
+    alignas (64) float laneMix[chunkSize * LaneWidth];
+};
+
+using VoiceBank = VoiceBankEngine<JUCEBOX_VOICEBANK_LANES>;
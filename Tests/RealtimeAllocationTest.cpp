@@ -0,0 +1,70 @@
+// Checks that the audio callback's allocation checks catch what they are meant to:
+// an ordinary block passes, and a block with more MIDI than prepareToPlay made room
+// for, which makes the processor's MidiBuffers grow, is reported.
+//
+// Built and run by the CMake project in the repository root, with the checks on
+// whatever the build type:
+//   ctest -R RealtimeAllocation
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+#include <cstdio>
+
+namespace
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int blockSize = 512;
+
+    int violationsDuring (JUCEboxAudioProcessor& processor, const juce::MidiBuffer& input)
+    {
+        juce::AudioBuffer<float> buffer (processor.getTotalNumOutputChannels(), blockSize);
+        auto midi = input;
+
+        const auto before = getNumRealtimeAllocationViolations();
+        processor.processBlock (buffer, midi);
+        return getNumRealtimeAllocationViolations() - before;
+    }
+
+    bool expect (bool condition, const char* what)
+    {
+        std::printf ("%s: %s\n", condition ? "passed" : "FAILED", what);
+        return condition;
+    }
+}
+
+int main()
+{
+    // The processors under test start timers, so a message manager has to exist first
+    juce::MessageManager::getInstance();
+
+    auto passed = true;
+
+    {
+        JUCEboxAudioProcessor processor;
+        processor.setRateAndBufferSizeDetails (sampleRate, blockSize);
+        processor.prepareToPlay (sampleRate, blockSize);
+
+        juce::MidiBuffer chord;
+
+        for (auto note : { 60, 64, 67 })
+            chord.addEvent (juce::MidiMessage::noteOn (1, note, 0.8f), 0);
+
+        passed &= expect (violationsDuring (processor, chord) == 0, "a block with a few notes doesn't allocate");
+        passed &= expect (violationsDuring (processor, {}) == 0, "an empty block doesn't allocate");
+
+        // Well past the 2048 events a block has room for, so the copy into the synth's buffer has to grow it
+        juce::MidiBuffer flood;
+
+        for (int i = 0; i < 5000; ++i)
+            flood.addEvent (juce::MidiMessage::noteOn (1, 24 + i % 72, 0.8f), i % blockSize);
+
+        passed &= expect (violationsDuring (processor, flood) > 0, "an overfilled MidiBuffer is reported");
+
+        processor.releaseResources();
+    }
+
+    juce::DeletedAtShutdown::deleteAll();
+    juce::MessageManager::deleteInstance();
+    return passed ? 0 : 1;
+}
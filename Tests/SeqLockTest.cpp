@@ -0,0 +1,100 @@
+// Hammers a SeqLock with one writer and several readers and checks that no
+// reader ever sees a torn value, or one older than a value it has already seen.
+//
+// Built by the CMake project in the repository root whether or not JUCE is
+// found, and run with the other tests:
+//   ctest -R SeqLock
+
+#include "SeqLock.h"
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Larger than any one atomic word, as TransportSnapshot is, with every field
+    // derived from the same count so a mix of two writes shows
+    struct Value
+    {
+        uint64_t count = 0;
+        double position = 0.0;
+        int32_t beat = 0;
+        int32_t negated = 0;
+        uint64_t words[4] {};
+    };
+
+    Value makeValue (uint64_t count)
+    {
+        Value v;
+        v.count = count;
+        v.position = (double) count * 0.5;
+        v.beat = (int32_t) count;
+        v.negated = -(int32_t) count;
+
+        for (auto& w : v.words)
+            w = count * 0x9e3779b97f4a7c15ull;
+
+        return v;
+    }
+
+    bool isWhole (const Value& v)
+    {
+        const auto expected = makeValue (v.count);
+        return std::memcmp (&v, &expected, sizeof (Value)) == 0;
+    }
+
+    constexpr uint64_t numWrites = 2000000;
+    constexpr int numReaders = 3;
+}
+
+int main()
+{
+    SeqLock<Value> lock;
+    std::atomic<bool> writing { true };
+    std::atomic<int> numTorn { 0 }, numBackwards { 0 };
+    std::vector<std::thread> readers;
+    std::vector<uint64_t> numReads ((size_t) numReaders);
+
+    for (int r = 0; r < numReaders; ++r)
+    {
+        readers.emplace_back ([&, r]
+        {
+            uint64_t last = 0;
+
+            while (writing.load (std::memory_order_relaxed))
+            {
+                const auto v = lock.load();
+                ++numReads[(size_t) r];
+
+                if (! isWhole (v))
+                    ++numTorn;
+                else if (v.count < last)
+                    ++numBackwards;
+
+                last = v.count;
+            }
+        });
+    }
+
+    for (uint64_t i = 1; i <= numWrites; ++i)
+        lock.store (makeValue (i));
+
+    writing = false;
+
+    for (auto& reader : readers)
+        reader.join();
+
+    uint64_t totalReads = 0;
+    for (auto n : numReads)
+        totalReads += n;
+
+    const auto last = lock.load();
+    const auto passed = numTorn == 0 && numBackwards == 0 && isWhole (last) && last.count == numWrites;
+
+    std::printf ("%llu writes, %llu reads on %d threads: %d torn, %d out of order: %s\n",
+                 (unsigned long long) numWrites, (unsigned long long) totalReads, numReaders,
+                 numTorn.load(), numBackwards.load(), passed ? "passed" : "FAILED");
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+// Renders every MIDI file in a directory to audio through JUCEboxAudioProcessor,
+// with no editor and no audio device, spread over all cores.
+//
+// Built by the CMake project in the repository root:
+//   JUCEboxBatchRender <midi dir> <output dir> [--tempo bpm] [--rate 48000] [--loops 1]
+//                      [--format wav|flac] [--threads n] [--engine bank|voices] [--polyphony 128]
+//
+// Each file is imported as the looper would import it, as one layer of up to 16
+// bars with the file's time signature, and played --loops times round plus the
+// release tail. --tempo overrides the tempo in the files; either way it is kept
+// to the looper's 60 to 200 BPM.
+//
+// LoopBouncer keeps one processor per worker thread and writes each file as it
+// renders. Files are read from the directory as workers come free, never more
+// than two per worker at a time, so memory stays flat however many there are.
+
+#include <JuceHeader.h>
+#include "LoopBouncer.h"
+
+#include <cstdio>
+
+namespace
+{
+    struct Options
+    {
+        juce::File inputDir, outputDir;
+        double tempo = 0.0;   // 0 to keep each file's own
+        double sampleRate = 48000.0;
+        int numLoops = 1;
+        juce::String format = "wav";
+        int numThreads = juce::SystemStats::getNumCpus();
+        JUCEboxAudioProcessor::SynthEngine engine = JUCEboxAudioProcessor::SynthEngine::voiceBank;
+        int polyphony = JUCEboxAudioProcessor::defaultPolyphony;
+    };
+
+    bool parseOptions (int argc, char* argv[], Options& options)
+    {
+        juce::StringArray paths;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const juce::String arg (argv[i]);
+
+            if (! arg.startsWith ("--"))
+            {
+                paths.add (arg);
+                continue;
+            }
+
+            const juce::String value (i + 1 < argc ? argv[i + 1] : "");
+
+            if (value.isEmpty())
+                return false;
+
+            ++i;
+
+            if (arg == "--tempo" || arg == "--rate")
+            {
+                // Text that isn't a number parses as 0, which would quietly keep the default
+                const auto number = value.getDoubleValue();
+
+                if (number <= 0.0)
+                    return false;
+
+                (arg == "--tempo" ? options.tempo : options.sampleRate) = number;
+            }
+            else if (arg == "--loops")                 options.numLoops = juce::jmax (1, value.getIntValue());
+            else if (arg == "--format")                options.format = value;
+            else if (arg == "--threads")               options.numThreads = juce::jmax (1, value.getIntValue());
+            else if (arg == "--polyphony")             options.polyphony = juce::jlimit (1, JUCEboxAudioProcessor::maxPolyphony, value.getIntValue());
+            else if (arg == "--engine")
+            {
+                if (value == "bank")                   options.engine = JUCEboxAudioProcessor::SynthEngine::voiceBank;
+                else if (value == "voices")            options.engine = JUCEboxAudioProcessor::SynthEngine::synthesiserVoices;
+                else                                   return false;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        if (paths.size() != 2)
+            return false;
+
+        const auto cwd = juce::File::getCurrentWorkingDirectory();
+        options.inputDir = cwd.getChildFile (paths[0]);
+        options.outputDir = cwd.getChildFile (paths[1]);
+
+        return options.format == "wav" || options.format == "flac";
+    }
+
+    // The file as the looper's import reads it, with the tempo, time signature and
+    // length set through the parameters, since that's how a session carries them
+    bool createJob (const juce::File& midiFile, const Options& options, JUCEboxAudioProcessor& prototype, LoopBouncer::Job& job)
+    {
+        juce::MidiFile midi;
+        std::vector<RecordedNote> notes;
+        LoopFileWorker::LoopSettings settings;
+
+        auto in = midiFile.createInputStream();
+
+        if (in == nullptr || ! in->openedOk() || ! midi.readFrom (*in) || ! LoopFileWorker::readMidiFile (midi, notes, settings))
+            return false;
+
+        if (options.tempo > 0.0)
+            settings.bpm = options.tempo;
+
+        job = {};
+
+        auto setParameter = [&] (const char* id, double value)
+        {
+            job.state.parameters.push_back ({ id, prototype.apvts.getParameter (id)->convertTo0to1 ((float) value) });
+        };
+
+        setParameter ("TEMPO", settings.bpm);
+        setParameter ("BEATS_PER_BAR", settings.beatsPerBar);
+        setParameter ("NUM_BARS", settings.numBars);
+        setParameter ("POLYPHONY", options.polyphony);
+
+        job.state.layers.emplace_back();
+        LoopTimeline::toEvents (notes, job.state.layers.back().events);
+
+        job.file = options.outputDir.getChildFile (midiFile.getFileNameWithoutExtension() + "." + options.format);
+        job.numLoops = options.numLoops;
+        job.sampleRate = options.sampleRate;
+        job.engine = options.engine;
+        return true;
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    Options options;
+
+    if (! parseOptions (argc, argv, options))
+    {
+        std::fprintf (stderr, "usage: %s <midi dir> <output dir> [--tempo bpm] [--rate 48000] [--loops 1]\n"
+                              "          [--format wav|flac] [--threads n] [--engine bank|voices] [--polyphony n]\n", argv[0]);
+        return 1;
+    }
+
+    if (! options.inputDir.isDirectory())
+    {
+        std::fprintf (stderr, "%s is not a directory\n", options.inputDir.getFullPathName().toRawUTF8());
+        return 1;
+    }
+
+    if (! options.outputDir.createDirectory())
+    {
+        std::fprintf (stderr, "could not create %s\n", options.outputDir.getFullPathName().toRawUTF8());
+        return 1;
+    }
+
+    // Each worker's processor starts parameter timers, which need a message manager
+    // to exist even though this thread never runs its loop
+    juce::MessageManager::getInstance();
+
+    int numRendered = 0, numFailed = 0;
+    double audioSeconds = 0.0;
+    const auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+    {
+        juce::CriticalSection outputLock;
+        juce::WaitableEvent jobFinished;
+        std::atomic<int> inFlight { 0 };
+        const auto maxInFlight = 2 * options.numThreads;
+
+        // Only used to turn parameter values into the normalised ones a session holds
+        JUCEboxAudioProcessor prototype;
+
+        // Declared after what its callbacks use, so it has waited for its workers before those go
+        LoopBouncer bouncer (options.numThreads);
+
+        for (const auto& entry : juce::RangedDirectoryIterator (options.inputDir, false, "*.mid;*.midi"))
+        {
+            const auto midiFile = entry.getFile();
+            LoopBouncer::Job job;
+
+            if (! createJob (midiFile, options, prototype, job))
+            {
+                const juce::ScopedLock lock (outputLock);
+                std::printf ("%s: no notes read, skipped\n", midiFile.getFileName().toRawUTF8());
+                ++numFailed;
+                continue;
+            }
+
+            while (inFlight.load() >= maxInFlight)
+                jobFinished.wait (100);
+
+            ++inFlight;
+            const auto target = job.file;
+
+            std::vector<LoopBouncer::Job> jobs;
+            jobs.push_back (std::move (job));
+
+            bouncer.bounce (std::move (jobs), [&, midiFile, target] (const LoopBouncer::Report& report)
+            {
+                const auto& result = report.results.front();
+
+                {
+                    const juce::ScopedLock lock (outputLock);
+
+                    if (result.succeeded)
+                    {
+                        ++numRendered;
+                        audioSeconds += result.audioSeconds;
+                        std::printf ("%s -> %s  %.1f s in %.2f s (%.0fx)\n", midiFile.getFileName().toRawUTF8(),
+                                     target.getFileName().toRawUTF8(), result.audioSeconds, result.renderSeconds,
+                                     result.renderSeconds > 0.0 ? result.audioSeconds / result.renderSeconds : 0.0);
+                    }
+                    else
+                    {
+                        ++numFailed;
+                        std::printf ("%s: could not write %s\n", midiFile.getFileName().toRawUTF8(), target.getFullPathName().toRawUTF8());
+                    }
+
+                    std::fflush (stdout);
+                }
+
+                --inFlight;
+                jobFinished.signal();
+            });
+        }
+
+        while (inFlight.load() > 0)
+            jobFinished.wait (100);
+    }
+
+    const auto elapsed = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    std::printf ("%d rendered, %d failed: %.1f s of audio in %.1f s on %d threads (%.0fx real time)\n",
+                 numRendered, numFailed, audioSeconds, elapsed, options.numThreads,
+                 elapsed > 0.0 ? audioSeconds / elapsed : 0.0);
+
+    juce::DeletedAtShutdown::deleteAll();
+    juce::MessageManager::deleteInstance();
+    return numFailed == 0 ? 0 : 2;
+}